@@ -0,0 +1,98 @@
+// Per-level timing of the multigrid smoother, scalar reference against the parallel SIMD one
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <cstdlib>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cmath>
+#include "sim/mgsolve.hpp"
+
+using namespace std;
+
+extern const char* git_version_short;
+
+static void usage()
+{
+	cout << "Usage: partikel_mgbench [options]" << endl;
+	cout << "  -d <n,m,...>   grid sizes per axis, powers of 2 (default 256,512,1024)" << endl;
+	cout << "  -i <sweeps>    red-black sweeps per level and smoother (default 20)" << endl;
+	cout << "  -t <threads>   smoother threads (default: hardware threads)" << endl;
+	exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+	cout << "Partikel multigrid bench " << git_version_short << endl;
+
+	vector<int> sizes;
+	int sweeps = 20;
+	int threads = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "-d" && hasValue)
+		{
+			stringstream list(argv[++i]);
+			string n;
+			while (getline(list, n, ','))
+				sizes.push_back(atoi(n.c_str()));
+		}
+		else if (arg == "-i" && hasValue) sweeps = atoi(argv[++i]);
+		else if (arg == "-t" && hasValue) threads = atoi(argv[++i]);
+		else usage();
+	}
+	if (sizes.empty())
+		sizes = { 256, 512, 1024 };
+	if (sweeps <= 0)
+		usage();
+
+	// host grids only, no OpenCL context needed
+	CLQueue queue;
+	BC bc(BC::Type::Neumann, 0, 1);
+	mt19937 rnd(1);
+	uniform_real_distribution<float> dist(-1, 1);
+
+	for (int n : sizes)
+	{
+		cout << endl;
+		MultigridPoisson mg(Vec2i(n, n), 1.0f / n, queue, BufferType::Host, threads);
+		mg.bcNegX = mg.bcPosX = mg.bcNegY = mg.bcPosY = bc;
+		cout << "grid " << n << "^2, " << sweeps << " sweeps, " << mg.pool.size() << " threads" << endl;
+		cout << "level       size   scalar ms   parallel ms   speedup   max diff" << endl;
+		for (size_t l = 0; l < mg.levels.size(); l++)
+		{
+			MGLevel& level = *mg.levels[l];
+			for (auto& x : level.b.data.buffer)
+				x = dist(rnd);
+
+			// same start for both smoothers, one untimed sweep each to warm the caches
+			double time[2];
+			vector<float> result[2];
+			for (int parallel = 0; parallel < 2; parallel++)
+			{
+				mg.parallelRelax = parallel != 0;
+				mg.relax((int)l, 1, false);
+				level.u.clear();
+				mg.relaxTime[l] = 0;
+				mg.relax((int)l, sweeps, false);
+				time[parallel] = mg.relaxTime[l];
+				result[parallel] = level.u.data.buffer;
+			}
+
+			float diff = 0;
+			for (size_t i = 0; i < result[0].size(); i++)
+				diff = max(diff, fabs(result[0][i] - result[1][i]));
+			cout << setw(5) << l << setw(11) << level.dim.x << fixed << setprecision(3)
+				<< setw(12) << 1000.0 * time[0] / sweeps << setw(14) << 1000.0 * time[1] / sweeps
+				<< setw(10) << setprecision(2) << time[0] / time[1]
+				<< scientific << setprecision(2) << setw(11) << diff << endl;
+			cout.unsetf(ios::floatfield);
+		}
+	}
+	return 0;
+}
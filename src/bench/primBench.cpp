@@ -0,0 +1,180 @@
+// Bandwidth benchmark of the OpenCL primitives
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <cmath>
+#include "compute/computeMain.hpp"
+#include "compute/primitives.hpp"
+
+using namespace std;
+
+extern const char* git_version_short;
+
+static void usage()
+{
+	cout << "Usage: partikel_primbench [options]" << endl;
+	cout << "  -n <count>     elements (default 16777216)" << endl;
+	cout << "  -r <reps>      timed repetitions per primitive (default 20)" << endl;
+	cout << "  -b <bins>      histogram bins (default 256)" << endl;
+	cout << "  --peak <GB/s>  theoretical device bandwidth, also report against it" << endl;
+	cout << "  --cpu/--gpu    restrict OpenCL device type" << endl;
+	exit(1);
+}
+
+// mean seconds per call, after one untimed call
+static double timeIt(CLQueue& queue, int reps, const function<void()>& fn)
+{
+	fn();
+	clFinish(queue.handle);
+	auto start = chrono::high_resolution_clock::now();
+	for (int i = 0; i < reps; i++)
+		fn();
+	clFinish(queue.handle);
+	return chrono::duration<double>(chrono::high_resolution_clock::now() - start).count() / reps;
+}
+
+int main(int argc, char* argv[])
+{
+	cout << "Partikel primitives bench " << git_version_short << endl;
+
+	int n = 16 * 1024 * 1024;
+	int reps = 20;
+	int numBins = 256;
+	double peak = 0;
+	cl_device_type deviceType = CL_DEVICE_TYPE_ALL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "-n" && hasValue) n = atoi(argv[++i]);
+		else if (arg == "-r" && hasValue) reps = atoi(argv[++i]);
+		else if (arg == "-b" && hasValue) numBins = atoi(argv[++i]);
+		else if (arg == "--peak" && hasValue) peak = atof(argv[++i]);
+		else if (arg == "--cpu") deviceType = CL_DEVICE_TYPE_CPU;
+		else if (arg == "--gpu") deviceType = CL_DEVICE_TYPE_GPU;
+		else usage();
+	}
+	if (n <= 0 || reps <= 0 || numBins <= 0)
+		usage();
+
+	CLQueue queue;
+	createComputeQueue(queue, deviceType);
+	Primitives prims(queue);
+
+	// host data and reference results
+	mt19937 rng(1);
+	CLBuffer<cl_uint> keys(queue, n, BufferType::Both), flags(queue, n, BufferType::Both);
+	CLBuffer<cl_uint> out(queue, n, BufferType::Both), bins(queue, numBins, BufferType::Both);
+	CLBuffer<cl_float> values(queue, n, BufferType::Both), copyDst(queue, n, BufferType::Gpu);
+	CLBuffer<cl_float2> vectors(queue, n, BufferType::Both);
+	uniform_real_distribution<float> uniform(-1.0f, 1.0f);
+	for (int i = 0; i < n; i++)
+	{
+		keys.buffer[i] = rng() % (numBins + numBins / 8 + 1); // some out of range
+		flags.buffer[i] = rng() & 1;
+		values.buffer[i] = uniform(rng);
+		vectors.buffer[i] = { { uniform(rng), uniform(rng) } };
+	}
+	keys.upload();
+	flags.upload();
+	values.upload();
+	vectors.upload();
+
+	// practical peak: device-side buffer copy, read + write
+	double copyTime = timeIt(queue, reps, [&] { copyDst.copyFrom(values, n); });
+	double copyBW = 2.0 * n * sizeof(cl_float) / copyTime * 1e-9;
+
+	struct Result { string name; double seconds, bytes; bool ok; };
+	vector<Result> results;
+	bool ok;
+
+	// scans: read + write n
+	double t = timeIt(queue, reps, [&] { prims.exclusiveScan(flags, out, n); });
+	out.download();
+	ok = true;
+	for (cl_uint i = 0, sum = 0; i < (cl_uint)n; sum += flags.buffer[i], i++)
+		ok = ok && out.buffer[i] == sum;
+	results.push_back({ "exclusive scan", t, 2.0 * n * sizeof(cl_uint), ok });
+
+	t = timeIt(queue, reps, [&] { prims.inclusiveScan(flags, out, n); });
+	out.download();
+	ok = true;
+	for (cl_uint i = 0, sum = 0; i < (cl_uint)n; i++)
+		ok = ok && out.buffer[i] == (sum += flags.buffer[i]);
+	results.push_back({ "inclusive scan", t, 2.0 * n * sizeof(cl_uint), ok });
+
+	// reductions: read n
+	float fsum = 0;
+	t = timeIt(queue, reps, [&] { fsum = prims.reduce(values, n, ReduceOp::Sum); });
+	double ref = 0, refAbs = 0;
+	for (int i = 0; i < n; i++)
+	{
+		ref += values.buffer[i];
+		refAbs += fabs(values.buffer[i]);
+	}
+	results.push_back({ "sum float", t, 1.0 * n * sizeof(cl_float), fabs(fsum - ref) <= 1e-5 * refAbs + 1e-3 });
+
+	float fmaxv = 0;
+	t = timeIt(queue, reps, [&] { fmaxv = prims.reduce(values, n, ReduceOp::Max); });
+	results.push_back({ "max float", t, 1.0 * n * sizeof(cl_float),
+		fmaxv == *max_element(values.buffer.begin(), values.buffer.begin() + n) });
+
+	cl_uint umin = 0;
+	t = timeIt(queue, reps, [&] { umin = prims.reduce(keys, n, ReduceOp::Min); });
+	results.push_back({ "min uint", t, 1.0 * n * sizeof(cl_uint),
+		umin == *min_element(keys.buffer.begin(), keys.buffer.begin() + n) });
+
+	float norm = 0;
+	t = timeIt(queue, reps, [&] { norm = prims.maxNorm(vectors, n); });
+	float refNorm = 0;
+	for (int i = 0; i < n; i++)
+		refNorm = max(refNorm, sqrt(vectors.buffer[i].s[0] * vectors.buffer[i].s[0] + 
+			vectors.buffer[i].s[1] * vectors.buffer[i].s[1]));
+	results.push_back({ "max norm float2", t, 1.0 * n * sizeof(cl_float2), fabs(norm - refNorm) < 1e-5f });
+
+	// compaction: read flags, write the selected indices
+	int selected = 0;
+	t = timeIt(queue, reps, [&] { selected = prims.compact(flags, n, out); });
+	out.download();
+	ok = true;
+	for (int i = 0, j = 0; i < n; i++)
+		if (flags.buffer[i])
+			ok = ok && j < selected && out.buffer[j++] == (cl_uint)i;
+	results.push_back({ "compact", t, (double)(n + selected) * sizeof(cl_uint), ok });
+
+	// histogram: read n
+	t = timeIt(queue, reps, [&] { prims.histogram(keys, n, bins, numBins); });
+	bins.download();
+	vector<cl_uint> refBins(numBins, 0);
+	for (int i = 0; i < n; i++)
+		if (keys.buffer[i] < (cl_uint)numBins)
+			refBins[keys.buffer[i]]++;
+	results.push_back({ "histogram", t, 1.0 * n * sizeof(cl_uint), 
+		equal(refBins.begin(), refBins.end(), bins.buffer.begin()) });
+
+	cout << endl << n << " elements, " << numBins << " histogram bins" << endl;
+	cout << "buffer copy:       " << fixed << setprecision(1) << copyBW << " GB/s" << endl;
+	if (peak > 0)
+		cout << "device peak:       " << peak << " GB/s" << endl;
+	cout << endl << "primitive             ms      GB/s   % copy" << (peak > 0 ? "   % peak" : "") << "  check" << endl;
+	bool allOk = true;
+	for (auto& r : results)
+	{
+		double bw = r.bytes / r.seconds * 1e-9;
+		cout << "  " << setw(16) << left << r.name << right << setw(8) << setprecision(3) << r.seconds * 1000
+			<< setw(10) << setprecision(1) << bw << setw(9) << 100 * bw / copyBW;
+		if (peak > 0)
+			cout << setw(9) << 100 * bw / peak;
+		cout << "  " << (r.ok ? "ok" : "FAILED") << endl;
+		allOk = allOk && r.ok;
+	}
+	return allOk ? 0 : 1;
+}
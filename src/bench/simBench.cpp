@@ -0,0 +1,550 @@
+// Headless benchmark of the PBD particle step
+
+#include <iostream>
+#include <iomanip>
+#include <memory>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include "compute/computeMain.hpp"
+#include "sim/particle.hpp"
+#include "sim/pbdSolver.hpp"
+#include "sim/nativeSolver.hpp"
+#include "sim/multiSolver.hpp"
+#include "compute/gpuSort.hpp"
+#include "compute/tuneCache.hpp"
+
+using namespace std;
+
+extern const char* git_version_short;
+
+static void usage()
+{
+	cout << "Usage: partikel_bench [options]" << endl;
+	cout << "  -n <count>     number of particles (default 524288)" << endl;
+	cout << "  -p <density>   particles per cell, overrides -n" << endl;
+	cout << "  -d <cells>     domain size in cells per axis, power of 2 (default 1024)" << endl;
+	cout << "  -s <substeps>  substeps per frame (default 3)" << endl;
+	cout << "  -c <subcols>   collision re-sorts per substep (default 1)" << endl;
+	cout << "  -i <citer>     constraint iterations (default 5)" << endl;
+	cout << "  -f <frames>    timed frames (default 100)" << endl;
+	cout << "  -w <frames>    warmup frames (default 5)" << endl;
+	cout << "  --cpu, --gpu   restrict to device type (default: any)" << endl;
+	cout << "  --device <sel> device by index, name substring, cpu or gpu" << endl;
+	cout << "  --list-devices print the device indices and exit" << endl;
+	cout << "  --morton       Z-order cell hash instead of row-major (currently slower, see --compare morton)" << endl;
+	cout << "  --compact      cell table sized by particle count instead of domain" << endl;
+	cout << "  --binning      counting sort by cell (histogram, scan, scatter) instead of radix sort" << endl;
+	cout << "  --coherent <f> sort only particles that changed cells, full sort above fraction f" << endl;
+	cout << "  --specialize   build kernels with domain, radius, omega and work-group size as constants" << endl;
+	cout << "                 (gain not yet measured on a device, see --compare specialize)" << endl;
+	cout << "  --untiled      global memory collide kernel instead of the local-memory tiled one" << endl;
+	cout << "  --skin <r>     Verlet neighbour lists with skin distance in particle radii (default: off)" << endl;
+	cout << "  --gauss-seidel 9-colour Gauss-Seidel constraint solver instead of SOR Jacobi" << endl;
+	cout << "  --gs-omega <w> Gauss-Seidel relaxation (default 1)" << endl;
+	cout << "  --compare specialize  per-stage times of generic and specialised kernel builds" << endl;
+	cout << "  --compare morton      frame times of row-major and Morton hash at each --densities value;" << endl;
+	cout << "                        native runs measured Morton 0.69-0.78x at 1024^2, no device numbers yet" << endl;
+	cout << "  --densities <p,q,...> particles per cell for --compare morton (default 0.25,0.5,1)" << endl;
+	cout << "  --residual     constraint residual vs iteration count for Jacobi and Gauss-Seidel" << endl;
+	cout << "  --native       native multithreaded C++ solver instead of OpenCL" << endl;
+	cout << "  -t <threads>   native solver threads (default: hardware threads)" << endl;
+	cout << "  --multi <n>    split the selected device into n sub-devices, one slab of the domain each" << endl;
+	cout << "  --devices <i,j,...>  one slab of the domain per device, selected as for --device" << endl;
+	cout << "  --validate     compare OpenCL and native results after one frame, with --skin also check the lists" << endl;
+	cout << "  --tune-sort    autotune the radix sort for this device and store the result" << endl;
+	cout << "  --tune-wg      time work-group sizes per kernel during warmup and store the winners" << endl;
+	cout << "  --wg <size>    fixed work-group size for every kernel, no tuned sizes (default 64)" << endl;
+	cout << "  --ooo          out-of-order queue with dependency-tracked scheduling" << endl;
+	cout << "  --no-binaries  build kernels from source, skip the program binary cache" << endl;
+	cout << "  --profile      per-kernel event profile of the timed frames" << endl;
+	cout << "  --profile-frames <file>  write per-frame kernel breakdown as csv" << endl;
+	exit(1);
+}
+
+// Particle order differs between the backends once the float results diverge
+// in the last bits, so pair the particles by the id seeded into phase, which
+// both solvers carry through their sorts. Every particle has to lie within
+// 5% of a cell of its native counterpart.
+static bool validateParticles(const DynamicParticles& gpu, const DynamicParticles& cpu, const Domain& domain)
+{
+	const int n = gpu.size;
+	vector<int> gpuAt(n, -1), cpuAt(n, -1);
+	for (int i = 0; i < n; i++)
+	{
+		const cl_int g = gpu.phase.buffer[i], c = cpu.phase.buffer[i];
+		if (g < 0 || g >= n || c < 0 || c >= n || gpuAt[g] >= 0 || cpuAt[c] >= 0)
+		{
+			cout << "validate: particle ids are not a permutation, FAILED" << endl;
+			return false;
+		}
+		gpuAt[g] = i;
+		cpuAt[c] = i;
+	}
+
+	const float tolerance = 0.05f * domain.dx;
+	double maxErr = 0, sumErr = 0;
+	int outliers = 0;
+	for (int id = 0; id < n; id++)
+	{
+		const cl_float2 a = gpu.p.buffer[gpuAt[id]], b = cpu.p.buffer[cpuAt[id]];
+		const double err = hypot(a.x - b.x, a.y - b.y);
+		maxErr = max(maxErr, err);
+		sumErr += err;
+		if (!(err <= tolerance))
+			outliers++;
+	}
+	cout << "validate: mean error " << sumErr / n << ", max error " << maxErr << ", "
+		<< outliers << " of " << n << " particles beyond " << tolerance << endl;
+	if (outliers > 0)
+	{
+		cout << "validate: FAILED" << endl;
+		return false;
+	}
+	return true;
+}
+
+// ms per frame of the unsynchronized run and per stage of the synchronized one
+struct ConfigTimes
+{
+	double frame = 0;
+	map<string, double> stages;
+};
+
+static ConfigTimes timeConfig(CLQueue& queue, bool native, int threads, const Domain& domain, const PBDParams& params,
+							  int count, int warmup, int frames, float dt)
+{
+	DynamicParticles part(count, native ? BufferType::Host : BufferType::Both, queue);
+	seedRandomCount(part, domain, count, 0.01f);
+	unique_ptr<PBDSolverBase> solver;
+	if (native)
+		solver.reset(new NativePBDSolver(domain, params, threads));
+	else
+		solver.reset(new PBDSolver(queue, domain, params, count));
+
+	for (int i = 0; i < warmup; i++)
+		solver->step(part, dt);
+	solver->sync();
+	auto start = chrono::high_resolution_clock::now();
+	for (int i = 0; i < frames; i++)
+		solver->step(part, dt);
+	solver->sync();
+
+	ConfigTimes times;
+	times.frame = 1000.0 * chrono::duration<double>(chrono::high_resolution_clock::now() - start).count() / frames;
+	solver->timeStages = true;
+	for (int i = 0; i < frames; i++)
+		solver->step(part, dt);
+	for (auto& it : solver->stageTime)
+		times.stages[it.first] = 1000.0 * it.second / frames;
+	return times;
+}
+
+// Remaining penetration after a frame: particle overlaps plus wall
+// violations, as mean per particle and maximum, in units of the radius
+static void constraintResidual(const DynamicParticles& part, const Domain& domain, float R, 
+							   double& mean, double& maximum)
+{
+	const int n = part.size;
+	const auto& p = part.p.buffer;
+	const int sx = domain.size.x, sy = domain.size.y;
+	auto cellOf = [&](const cl_float2& pos) {
+		int x = min(max((int)((pos.x - domain.offset.x) / domain.dx), 0), sx - 1);
+		int y = min(max((int)((pos.y - domain.offset.y) / domain.dx), 0), sy - 1);
+		return y * sx + x;
+	};
+
+	// bucket by cell, counting sort
+	vector<int> cellStart(sx * sy + 1, 0), order(n);
+	for (int i = 0; i < n; i++)
+		cellStart[cellOf(p[i]) + 1]++;
+	for (int c = 0; c < sx * sy; c++)
+		cellStart[c + 1] += cellStart[c];
+	vector<int> fill(cellStart.begin(), cellStart.end() - 1);
+	for (int i = 0; i < n; i++)
+		order[fill[cellOf(p[i])]++] = i;
+
+	const float sizex = sx * domain.dx - R, sizey = sy * domain.dx - R;
+	double sum = 0;
+	maximum = 0;
+	for (int i = 0; i < n; i++)
+	{
+		double pen = 0;
+		int c = cellOf(p[i]), cx = c % sx, cy = c / sx;
+		for (int y = max(cy - 1, 0); y <= min(cy + 1, sy - 1); y++)
+		for (int x = max(cx - 1, 0); x <= min(cx + 1, sx - 1); x++)
+		for (int k = cellStart[y * sx + x]; k < cellStart[y * sx + x + 1]; k++)
+		{
+			int j = order[k];
+			if (j <= i)
+				continue;
+			float d = hypot(p[i].x - p[j].x, p[i].y - p[j].y);
+			if (d < 2 * R)
+				pen += 2 * R - d;
+		}
+		float px = p[i].x - domain.offset.x, py = p[i].y - domain.offset.y;
+		pen += max(R - px, 0.0f) + max(px - sizex, 0.0f) + max(R - py, 0.0f) + max(py - sizey, 0.0f);
+		sum += pen;
+		maximum = max(maximum, pen);
+	}
+	mean = sum / n / R;
+	maximum /= R;
+}
+
+int main(int argc, char* argv[])
+{
+	cout << "Partikel bench " << git_version_short << endl;
+
+	int count = 512 * 1024;
+	int domainSize = 1024;
+	float density = 0;
+	int frames = 100;
+	int warmup = 5;
+	CLDeviceSelect device;
+	bool profile = false;
+	bool outOfOrder = false;
+	bool native = false;
+	bool validate = false;
+	bool residual = false;
+	bool tuneSort = false;
+	int threads = 0;
+	string compare;
+	vector<float> densities;
+	int multi = 0;
+	vector<CLDeviceSelect> multiDevices;
+	string frameLogName;
+	PBDParams params;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "-n" && hasValue) count = atoi(argv[++i]);
+		else if (arg == "-p" && hasValue) density = (float)atof(argv[++i]);
+		else if (arg == "-d" && hasValue) domainSize = atoi(argv[++i]);
+		else if (arg == "-s" && hasValue) params.substeps = atoi(argv[++i]);
+		else if (arg == "-c" && hasValue) params.subcols = atoi(argv[++i]);
+		else if (arg == "-i" && hasValue) params.citer = atoi(argv[++i]);
+		else if (arg == "-f" && hasValue) frames = atoi(argv[++i]);
+		else if (arg == "-w" && hasValue) warmup = atoi(argv[++i]);
+		else if (arg == "--cpu") device.type = CL_DEVICE_TYPE_CPU;
+		else if (arg == "--gpu") device.type = CL_DEVICE_TYPE_GPU;
+		else if (arg == "--device" && hasValue) device = CLDeviceSelect::parse(argv[++i]);
+		else if (arg == "--list-devices") { listDevices(cout); return 0; }
+		else if (arg == "--morton") params.mortonHash = true;
+		else if (arg == "--compact") params.compactCells = true;
+		else if (arg == "--binning") params.countingSort = true;
+		else if (arg == "--coherent" && hasValue) params.coherentSort = (float)atof(argv[++i]);
+		else if (arg == "--specialize") params.specialize = true;
+		else if (arg == "--untiled") params.tiledCollide = false;
+		else if (arg == "--skin" && hasValue) params.skin = (float)atof(argv[++i]) * params.radius;
+		else if (arg == "--gauss-seidel") params.gaussSeidel = true;
+		else if (arg == "--gs-omega" && hasValue) params.gsOmega = (float)atof(argv[++i]);
+		else if (arg == "--compare" && hasValue) compare = argv[++i];
+		else if (arg == "--densities" && hasValue)
+		{
+			stringstream list(argv[++i]);
+			string p;
+			while (getline(list, p, ','))
+				densities.push_back((float)atof(p.c_str()));
+		}
+		else if (arg == "--residual") residual = true;
+		else if (arg == "--native") native = true;
+		else if (arg == "-t" && hasValue) threads = atoi(argv[++i]);
+		else if (arg == "--multi" && hasValue) multi = atoi(argv[++i]);
+		else if (arg == "--devices" && hasValue)
+		{
+			stringstream list(argv[++i]);
+			string sel;
+			while (getline(list, sel, ','))
+				multiDevices.push_back(CLDeviceSelect::parse(sel));
+		}
+		else if (arg == "--validate") validate = true;
+		else if (arg == "--tune-sort") tuneSort = true;
+		else if (arg == "--tune-wg") CLKernel::autotune = true;
+		else if (arg == "--wg" && hasValue) { params.wgSize = atoi(argv[++i]); params.autoLocal = false; }
+		else if (arg == "--ooo") outOfOrder = true;
+		else if (arg == "--no-binaries") CLProgram::cacheDir.clear();
+		else if (arg == "--profile") profile = true;
+		else if (arg == "--profile-frames" && hasValue) { profile = true; frameLogName = argv[++i]; }
+		else usage();
+	}
+	if (density > 0)
+		count = (int)(density * domainSize * domainSize);
+	if (count <= 0 || frames <= 0 || params.substeps <= 0 || params.subcols <= 0 || params.citer < 0 || multi < 0)
+		usage();
+	const bool split = multi > 0 || !multiDevices.empty();
+	if (split && (native || validate || residual))
+		usage();
+	if (!compare.empty() && compare != "specialize" && compare != "morton")
+		usage();
+	// native has no kernel builds to specialise
+	if ((!compare.empty() && split) || (compare == "specialize" && native))
+		usage();
+	if (densities.empty())
+		densities = { 0.25f, 0.5f, 1.0f };
+
+	CLQueue queue;
+	cl_command_queue_properties queueProps = 0;
+	if (profile)
+		queueProps |= CL_QUEUE_PROFILING_ENABLE;
+	if (outOfOrder)
+		queueProps |= CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
+	if (native && !validate)
+		profile = false;
+	else
+		createComputeQueue(queue, device, queueProps);
+
+	// the domain split needs one queue per slab, the kernel profile follows a single queue
+	vector<unique_ptr<CLQueue> > splitQueues;
+	if (multi > 0)
+		createSubDeviceQueues(splitQueues, device, multi, queueProps & ~CL_QUEUE_PROFILING_ENABLE);
+	for (auto& sel : multiDevices)
+	{
+		splitQueues.emplace_back(new CLQueue);
+		createComputeQueue(*splitQueues.back(), sel, queueProps & ~CL_QUEUE_PROFILING_ENABLE);
+	}
+	if (split)
+		profile = false;
+	CLProfiler profiler;
+	ofstream frameLog;
+
+	const float R = params.radius;
+	Domain domain = { { 0, 0 }, { (cl_uint)domainSize, (cl_uint)domainSize }, 2 * R };
+	const float dt = 1.0f / 60.0f * 0.1f;
+
+	if (tuneSort && !native)
+	{
+		RadixSort tuner(queue);
+		tuner.autotune(count);
+		cout << "radix sort: " << tuner.numWGs << " work-groups, stored in " 
+			<< TuneCache::get().filename << endl;
+	}
+
+	if (validate)
+	{
+		// same seed on both sides; compare after a single frame, later on the
+		// contact resolution amplifies rounding differences chaotically
+		DynamicParticles gpuPart(count, BufferType::Both, queue);
+		DynamicParticles cpuPart(count, BufferType::Host, queue);
+		seedRandomCount(gpuPart, domain, count, 0.01f);
+		seedRandomCount(cpuPart, domain, count, 0.01f);
+		for (int i = 0; i < count; i++)
+			gpuPart.phase.buffer[i] = cpuPart.phase.buffer[i] = i;
+		gpuPart.upload();
+		PBDSolver gpuSolver(queue, domain, params, count);
+		NativePBDSolver cpuSolver(domain, params, threads);
+		gpuSolver.step(gpuPart, dt);
+		cpuSolver.step(cpuPart, dt);
+		gpuPart.download();
+		if (!validateParticles(gpuPart, cpuPart, domain))
+			return 1;
+
+		// every pair the grid collide could see within the cutoff has to be in the lists
+		if (params.skin > 0 && !params.gaussSeidel)
+		{
+			int pairs;
+			int missing = gpuSolver.missingNeighbors(pairs);
+			cout << "validate: neighbour lists miss " << missing << " of " << pairs << " pairs within "
+				<< (2 * R + params.skin) / R << " R" << endl;
+			if (missing > 0)
+			{
+				cout << "validate: FAILED" << endl;
+				return 1;
+			}
+		}
+	}
+
+	if (residual)
+	{
+		// same scene for every configuration, residual at the end of the timed frames
+		cout << endl << "solver        citer   ms/frame   mean residual   max residual  (radii)" << endl;
+		for (int gs = 0; gs < 2; gs++)
+		for (int citer : { 1, 2, 3, 5, 8, 12 })
+		{
+			PBDParams rp = params;
+			rp.gaussSeidel = gs != 0;
+			rp.citer = citer;
+			DynamicParticles rpart(count, native ? BufferType::Host : BufferType::Both, queue);
+			seedRandomCount(rpart, domain, count, 0.01f);
+			unique_ptr<PBDSolverBase> rsolver;
+			if (native)
+				rsolver.reset(new NativePBDSolver(domain, rp, threads));
+			else
+				rsolver.reset(new PBDSolver(queue, domain, rp, count));
+
+			auto rstart = chrono::high_resolution_clock::now();
+			for (int i = 0; i < frames; i++)
+				rsolver->step(rpart, dt);
+			rsolver->sync();
+			double rtime = chrono::duration<double>(chrono::high_resolution_clock::now() - rstart).count();
+			if (!native)
+				rpart.download();
+
+			double mean, maximum;
+			constraintResidual(rpart, domain, R, mean, maximum);
+			cout << setw(12) << left << (gs ? "gauss-seidel" : "jacobi") << right << setw(7) << citer
+				<< fixed << setprecision(3) << setw(11) << 1000.0 * rtime / frames 
+				<< scientific << setprecision(3) << setw(16) << mean << setw(15) << maximum << endl;
+			cout.unsetf(ios::floatfield);
+		}
+		return 0;
+	}
+
+	if (compare == "specialize")
+	{
+		PBDParams generic = params, special = params;
+		generic.specialize = false;
+		special.specialize = true;
+		ConfigTimes a = timeConfig(queue, native, threads, domain, generic, count, warmup, frames, dt);
+		ConfigTimes b = timeConfig(queue, native, threads, domain, special, count, warmup, frames, dt);
+		cout << endl << "particles " << count << ", domain " << domainSize << "^2, ms/frame" << endl;
+		cout << "stage            generic   specialised   ratio" << endl;
+		auto row = [](const string& name, double ga, double sb) {
+			cout << "  " << setw(12) << left << name << right << fixed << setprecision(3) << setw(10) << ga 
+				<< setw(14) << sb << setw(8) << setprecision(2) << (sb > 0 ? ga / sb : 0) << endl;
+			cout.unsetf(ios::floatfield);
+		};
+		for (auto& it : a.stages)
+			row(it.first, it.second, b.stages[it.first]);
+		row("frame", a.frame, b.frame);
+		return 0;
+	}
+	if (compare == "morton")
+	{
+		PBDParams rowMajor = params, morton = params;
+		rowMajor.mortonHash = false;
+		morton.mortonHash = true;
+		cout << endl << "domain " << domainSize << "^2, " << (native ? "native" : "OpenCL") << ", ms/frame" << endl;
+		cout << "density   particles   row-major    morton   speedup" << endl;
+		for (float p : densities)
+		{
+			int n = (int)(p * domainSize * domainSize);
+			ConfigTimes a = timeConfig(queue, native, threads, domain, rowMajor, n, warmup, frames, dt);
+			ConfigTimes b = timeConfig(queue, native, threads, domain, morton, n, warmup, frames, dt);
+			cout << setw(7) << p << setw(12) << n << fixed << setprecision(3) << setw(12) << a.frame 
+				<< setw(10) << b.frame << setw(10) << setprecision(2) << a.frame / b.frame << endl;
+			cout.unsetf(ios::floatfield);
+		}
+		return 0;
+	}
+
+	DynamicParticles part(count, native || split ? BufferType::Host : BufferType::Both, queue);
+	seedRandomCount(part, domain, count, 0.01f);
+	unique_ptr<PBDSolverBase> solver;
+	if (native)
+		solver.reset(new NativePBDSolver(domain, params, threads));
+	else if (split)
+	{
+		vector<CLQueue*> queues;
+		for (auto& q : splitQueues)
+			queues.push_back(q.get());
+		solver.reset(new MultiPBDSolver(queues, domain, params, count));
+	}
+	else
+		solver.reset(new PBDSolver(queue, domain, params, count));
+	// counters of the single-device solver
+	PBDSolver* clSolver = native || split ? nullptr : (PBDSolver*)solver.get();
+
+	// enough launches of the once-per-substep kernels to try every size
+	if (CLKernel::autotune && !native)
+		warmup = max(warmup, 10);
+	for (int i = 0; i < warmup; i++)
+		solver->step(part, dt);
+	solver->sync();
+
+	// throughput, no synchronization between stages
+	int listBuilds = clSolver ? clSolver->listBuilds : 0;
+	int partialSorts = clSolver ? clSolver->partialSorts : 0;
+	auto start = chrono::high_resolution_clock::now();
+	for (int i = 0; i < frames; i++)
+		solver->step(part, dt);
+	solver->sync();
+	double total = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+	if (clSolver)
+	{
+		listBuilds = clSolver->listBuilds - listBuilds;
+		partialSorts = clSolver->partialSorts - partialSorts;
+	}
+
+	// kernel profile in its own run, as resolving events each frame stalls the queue
+	if (profile && !native)
+	{
+		profiler.attach(queue);
+		if (!frameLogName.empty())
+		{
+			frameLog.open(frameLogName);
+			frameLog << "frame,kernel,count,ms" << endl;
+			profiler.frameLog = &frameLog;
+		}
+		for (int i = 0; i < frames; i++)
+		{
+			solver->step(part, dt);
+			profiler.endFrame();
+		}
+		queue.profiler = nullptr;
+	}
+
+	// per-stage breakdown in a separate run, as it serializes the queue
+	solver->timeStages = true;
+	for (int i = 0; i < frames; i++)
+		solver->step(part, dt);
+	double stageTotal = 0;
+	for (auto& it : solver->stageTime)
+		stageTotal += it.second;
+
+	double stepsPerSec = frames / total;
+	cout << endl;
+	cout << "particles " << count << ", domain " << domainSize << "^2 (" << (float)count / domainSize / domainSize
+		<< " per cell, " << (params.mortonHash ? "morton" : "row-major") << " hash), substeps " << params.substeps
+		<< ", subcols " << params.subcols << ", citer " << params.citer 
+		<< (queue.outOfOrder ? ", out-of-order queue" : "")
+		<< (params.countingSort && !native ? ", counting sort" : "")
+		<< (params.specialize && !native ? ", specialised kernels" : "");
+	if (native)
+		cout << ", native " << ((NativePBDSolver*)solver.get())->threads() << " threads";
+	if (split)
+		cout << ", " << splitQueues.size() << " slabs";
+	cout << endl;
+	cout << "frames:            " << frames << " in " << total << " s" << endl;
+	cout << "steps/s:           " << stepsPerSec << endl;
+	cout << "substeps/s:        " << stepsPerSec * params.substeps << endl;
+	cout << "particle*steps/s:  " << stepsPerSec * count << endl;
+	if (params.skin > 0 && !params.gaussSeidel && clSolver)
+		cout << "list builds:       " << listBuilds << " of " << frames * params.substeps * params.subcols 
+			<< " sorts, skin " << params.skin / params.radius << " R" << endl;
+	if (params.coherentSort > 0 && !params.countingSort && clSolver)
+		cout << "partial sorts:     " << partialSorts << " of " 
+			<< (params.skin > 0 && !params.gaussSeidel ? listBuilds : frames * params.substeps * params.subcols) 
+			<< " sorts, limit " << params.coherentSort << endl;
+	cout << endl << "per-stage wall time (synchronized run):" << endl;
+	for (auto& it : solver->stageTime)
+	{
+		cout << "  " << setw(12) << left << it.first << right << setw(10) << fixed << setprecision(3)
+			<< 1000.0 * it.second / frames << " ms/frame " << setw(6) << setprecision(1)
+			<< 100.0 * it.second / stageTotal << " %" << endl;
+	}
+	if (split)
+	{
+		cout << endl;
+		((MultiPBDSolver*)solver.get())->printBalance(cout);
+	}
+	else if (!native)
+	{
+		cout << endl;
+		queue.pool.printStats(cout);
+	}
+	if (profile && !native)
+	{
+		cout << endl;
+		profiler.printSummary(cout);
+	}
+	return 0;
+}
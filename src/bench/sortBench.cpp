@@ -0,0 +1,183 @@
+// Benchmark and correctness check of the key/value sorts
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include "compute/computeMain.hpp"
+#include "compute/gpuSort.hpp"
+#include "compute/sorter.hpp"
+#include "tools/threadPool.hpp"
+
+using namespace std;
+
+extern const char* git_version_short;
+
+static void usage()
+{
+	cout << "Usage: partikel_sortbench [options]" << endl;
+	cout << "  --min <log2>   smallest size (default 10)" << endl;
+	cout << "  --max <log2>   largest size (default 24)" << endl;
+	cout << "  -r <reps>      timed repetitions, the fastest counts (default 5)" << endl;
+	cout << "  -t <threads>   host sort threads (default: all cores)" << endl;
+	cout << "  --csv <file>   also write the results as csv" << endl;
+	cout << "  --cpu/--gpu    restrict OpenCL device type" << endl;
+	exit(1);
+}
+
+enum class Distribution { Uniform, Clustered, NearlySorted };
+static const char* distributionNames[] = { "uniform", "clustered", "nearly sorted" };
+
+// values are the original positions, so the output can be checked against the input
+static void makeKeys(vector<cl_uint2>& keys, int n, Distribution dist, mt19937& rng)
+{
+	keys.resize(n);
+	if (dist == Distribution::Uniform)
+	{
+		for (int i = 0; i < n; i++)
+			keys[i] = { { (cl_uint)rng(), (cl_uint)i } };
+	}
+	else if (dist == Distribution::Clustered)
+	{
+		// a few dense clumps with many equal keys, like cell hashes of fluid blobs
+		vector<cl_uint> centers(16);
+		for (auto& c : centers)
+			c = rng() & 0x00FFFFFF;
+		normal_distribution<float> spread(0, 64);
+		for (int i = 0; i < n; i++)
+			keys[i] = { { (cl_uint)max(0, (int)centers[rng() % centers.size()] + (int)spread(rng)), (cl_uint)i } };
+	}
+	else
+	{
+		// sorted, then 1% of the keys moved a little, as between two substeps
+		for (int i = 0; i < n; i++)
+			keys[i] = { { (cl_uint)i * 4, (cl_uint)i } };
+		for (int k = 0; k < n / 100 + 1; k++)
+		{
+			int i = rng() % n;
+			keys[i].s[0] = (cl_uint)max(0, (int)keys[i].s[0] + (int)(rng() % 65) - 32);
+		}
+	}
+}
+
+// ordered by key, and every pair is one of the input
+static bool checkSorted(const vector<cl_uint2>& sorted, const vector<cl_uint2>& input, int n)
+{
+	vector<bool> seen(n, false);
+	for (int i = 0; i < n; i++)
+	{
+		cl_uint v = sorted[i].s[1];
+		if (v >= (cl_uint)n || seen[v] || input[v].s[0] != sorted[i].s[0])
+			return false;
+		seen[v] = true;
+		if (i > 0 && sorted[i - 1].s[0] > sorted[i].s[0])
+			return false;
+	}
+	return true;
+}
+
+int main(int argc, char* argv[])
+{
+	cout << "Partikel sort bench " << git_version_short << endl;
+
+	int minLog = 10, maxLog = 24;
+	int reps = 5;
+	int threads = 0;
+	string csvName;
+	cl_device_type deviceType = CL_DEVICE_TYPE_ALL;
+
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--min" && hasValue) minLog = atoi(argv[++i]);
+		else if (arg == "--max" && hasValue) maxLog = atoi(argv[++i]);
+		else if (arg == "-r" && hasValue) reps = atoi(argv[++i]);
+		else if (arg == "-t" && hasValue) threads = atoi(argv[++i]);
+		else if (arg == "--csv" && hasValue) csvName = argv[++i];
+		else if (arg == "--cpu") deviceType = CL_DEVICE_TYPE_CPU;
+		else if (arg == "--gpu") deviceType = CL_DEVICE_TYPE_GPU;
+		else usage();
+	}
+	if (minLog < 1 || maxLog > 28 || minLog > maxLog || reps <= 0)
+		usage();
+
+	CLQueue queue;
+	createComputeQueue(queue, deviceType);
+	ThreadPool pool(threads);
+
+	vector<unique_ptr<Sorter> > sorters;
+	sorters.emplace_back(new RadixSort(queue));
+	sorters.emplace_back(new BitonicSort(queue));
+	sorters.emplace_back(new HostRadixSort(pool));
+
+	ofstream csv;
+	if (!csvName.empty())
+	{
+		csv.open(csvName);
+		csv << "n,distribution,sorter,seconds,keys_per_s,ok" << endl;
+	}
+
+	cout << endl << "Mkeys/s, fastest of " << reps << "; host sort with " << pool.size() << " threads" << endl;
+	cout << setw(10) << "n" << "  " << setw(14) << left << "distribution" << right;
+	for (auto& s : sorters)
+		cout << setw(12) << s->name();
+	cout << "  fastest" << endl;
+
+	mt19937 rng(11);
+	vector<cl_uint2> input;
+	bool allOk = true;
+	for (int lg = minLog; lg <= maxLog; lg++)
+	for (int d = 0; d < 3; d++)
+	{
+		const int n = 1 << lg;
+		makeKeys(input, n, (Distribution)d, rng);
+		cout << setw(10) << n << "  " << setw(14) << left << distributionNames[d] << right;
+
+		double bestRate = 0;
+		const char* best = "";
+		for (auto& sorter : sorters)
+		{
+			CLBuffer<cl_uint2> data(queue, sorter->bufferSize(n), BufferType::Both);
+			double time = 1e30;
+			for (int rep = 0; rep < reps; rep++)
+			{
+				copy(input.begin(), input.end(), data.buffer.begin());
+				data.upload();
+				clFinish(queue.handle);
+				auto start = chrono::high_resolution_clock::now();
+				sorter->sort(data, n);
+				clFinish(queue.handle);
+				time = min(time, chrono::duration<double>(chrono::high_resolution_clock::now() - start).count());
+			}
+
+			if (!sorter->onHost())
+				data.download();
+			bool ok = checkSorted(data.buffer, input, n);
+			allOk = allOk && ok;
+
+			double rate = n / time;
+			if (rate > bestRate)
+			{
+				bestRate = rate;
+				best = sorter->name();
+			}
+			cout << setw(12) << fixed << setprecision(1) << rate * 1e-6;
+			if (!ok)
+				cout << " FAILED";
+			if (csv.is_open())
+				csv << n << "," << distributionNames[d] << "," << sorter->name() << "," 
+					<< scientific << time << "," << rate << "," << ok << endl;
+		}
+		cout << "  " << best << endl;
+	}
+	cout << endl;
+	queue.pool.printStats(cout);
+	return allOk ? 0 : 1;
+}
@@ -5,13 +5,15 @@
 #include <sstream>
 #include <iterator>
 #include <algorithm>
-#include "render/opengl.hpp"
+#include <chrono>
+#include <cstring>
 #include "compute/computeMain.hpp"
+#include "compute/tuneCache.hpp"
 #include "tools/log.hpp"
 #if defined (_WIN32)
-	#define WINDOWS_LEAN_AND_MEAN
-	#define NOMINMAX
-	#include <windows.h>
+	#include <direct.h>
+#else
+	#include <sys/stat.h>
 #endif
 
 using namespace std;
@@ -103,74 +105,6 @@ void clTest(cl_int err, const string& msg)
 	}
 }
 
-static cl_device_id findCPUDevice(cl_platform_id platform) 
-{
-	// Enumerate devices
-	cl_device_id allDevices[16];
-	cl_uint num;
-	clTest(clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 16, allDevices, &num), "list devices");
-	for (int i = 0; i < num; i++)
-	{
-		size_t size;
-		cl_device_type type;
-		clGetDeviceInfo(allDevices[i], CL_DEVICE_TYPE, sizeof(type), &type, &size);
-		if (type == CL_DEVICE_TYPE_CPU)
-			return allDevices[i];
-	}
-	return nullptr;
-}
-
-static vector<cl_context_properties> renderContextProps(cl_platform_id platform) 
-{
-	vector<cl_context_properties> props;	
-#if defined (__APPLE__)
-	props.push_back(CL_CONTEXT_PROPERTY_USE_CGL_SHAREGROUP_APPLE);
-	props.push_back((intptr_t)CGLGetShareGroup(CGLGetCurrentContext()));	
-#elif defined (WIN32)
-	props.push_back(CL_GL_CONTEXT_KHR);
-	props.push_back((cl_context_properties)wglGetCurrentContext());
-	props.push_back(CL_WGL_HDC_KHR);
-	props.push_back((cl_context_properties)wglGetCurrentDC());
-#else
-	props.push_back(CL_GL_CONTEXT_KHR);
-	props.push_back((cl_context_properties)glXGetCurrentContext());
-	props.push_back(CL_GLX_DISPLAY_KHR);
-	props.push_back((cl_context_properties)glXGetCurrentDisplay());	
-#endif
-	props.push_back(CL_CONTEXT_PLATFORM);
-	props.push_back((cl_context_properties)platform);
-	props.push_back(0);
-	return props;
-}
-
-static cl_device_id findRenderDevice(cl_platform_id platform) {
-	cl_device_id renderer;
-	cl_context_properties props[16];
-#if defined (__APPLE__)
-	CGLContextObj glContext = CGLGetCurrentContext();
-	CGLShareGroupObj shareGroup = CGLGetShareGroup(glContext);
-
-	context = clCreateContext(&renderContextProps(platform)[0], 0, NULL, 0, 0, &err);
-	clTest(err, "create gl context");
-
-	clTest(clGetGLContextInfoAPPLE(context, glContext, CL_CGL_DEVICE_FOR_CURRENT_VIRTUAL_SCREEN_APPLE,
-		sizeof(renderer), &renderer, NULL), "get gl context");
-	clReleaseContext(context);
-#elif defined (WIN32)
-	auto fn = (clGetGLContextInfoKHR_fn)clGetExtensionFunctionAddressForPlatform(platform, "clGetGLContextInfoKHR");
-	cl_int err = fn(&renderContextProps(platform)[0], CL_CURRENT_DEVICE_FOR_GL_CONTEXT_KHR, sizeof(renderer), &renderer, NULL);
-#else
-	
-#endif
-	cl_device_type type;
-	size_t size;
-	clGetDeviceInfo(renderer, CL_DEVICE_TYPE, sizeof(type), &type, &size);
-	if (type != CL_DEVICE_TYPE_GPU)
-		return nullptr;
-	
-	return renderer;
-}
-
 void CLQueue::printInfo() {
 	cl_device_type type;
 	size_t size;
@@ -187,78 +121,570 @@ void CLQueue::printInfo() {
 	cout << "  Device " << deviceName << endl;
 }
 
-void createQueues(CLQueue& cpu, CLQueue& gpu)
+void createQueueHandle(CLQueue& queue, cl_command_queue_properties properties)
 {
-	// Get platforms
+	// fall back to in-order execution if not supported
+	cl_command_queue_properties supported;
+	clTest(clGetDeviceInfo(queue.device, CL_DEVICE_QUEUE_PROPERTIES, sizeof(supported), &supported, nullptr), "queue properties");
+	if ((properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) && !(supported & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE))
+	{
+		cout << "Out-of-order queue not supported by device, using in-order queue" << endl;
+		properties &= ~CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
+	}
+
 	cl_int err;
+	queue.handle = clCreateCommandQueue(queue.context, queue.device, properties, &err);
+	clTest(err, "create queue");
+	queue.outOfOrder = (properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE) != 0;
+}
+
+// (platform, device) of every platform, in listDevices order
+static vector<pair<cl_platform_id, cl_device_id> > enumerateDevices()
+{
 	cl_uint numPlatforms;
 	cl_platform_id platform[16];
 	if (clGetPlatformIDs(16, &platform[0], &numPlatforms) != CL_SUCCESS || numPlatforms == 0)
 		fatalError("Can't obtain platforms");
 
-	// find GPU device
-	for (int i = 0; i < numPlatforms; i++)
+	vector<pair<cl_platform_id, cl_device_id> > list;
+	for (cl_uint i = 0; i < numPlatforms; i++)
 	{
-		gpu.device = findRenderDevice(platform[i]);
-		if (gpu.device) {
-			gpu.platform = platform[i];
-			break;
-		}
-		
+		cl_device_id devices[16];
+		cl_uint num;
+		if (clGetDeviceIDs(platform[i], CL_DEVICE_TYPE_ALL, 16, devices, &num) != CL_SUCCESS)
+			continue;
+		for (cl_uint j = 0; j < min(num, (cl_uint)16); j++)
+			list.push_back({ platform[i], devices[j] });
 	}
+	return list;
+}
 
-	// find CPU device: try to share context first, then the rest
-	cpu.device = findCPUDevice(gpu.platform);
-	if (cpu.device) 
+void listDevices(ostream& str)
+{
+	auto devices = enumerateDevices();
+	for (size_t i = 0; i < devices.size(); i++)
 	{
-		cpu.platform = gpu.platform;
-		cl_device_id devices[2] = { gpu.device, cpu.device };
-		gpu.context = clCreateContext(&renderContextProps(gpu.platform)[0], 2, devices, nullptr, nullptr, &err);
-		cpu.context = gpu.context;
-		clTest(err, "create context");
+		char platformName[256] = { 0 }, deviceName[256] = { 0 };
+		cl_device_type type;
+		clGetPlatformInfo(devices[i].first, CL_PLATFORM_NAME, sizeof(platformName) - 1, platformName, nullptr);
+		clGetDeviceInfo(devices[i].second, CL_DEVICE_NAME, sizeof(deviceName) - 1, deviceName, nullptr);
+		clGetDeviceInfo(devices[i].second, CL_DEVICE_TYPE, sizeof(type), &type, nullptr);
+		str << "  " << i << ": " << ((type & CL_DEVICE_TYPE_CPU) ? "CPU " : (type & CL_DEVICE_TYPE_GPU) ? "GPU " : "    ") 
+			<< deviceName << " (" << platformName << ")" << endl;
 	}
+}
+
+CLDeviceSelect CLDeviceSelect::parse(const string& arg)
+{
+	CLDeviceSelect select;
+	if (arg == "cpu")
+		select.type = CL_DEVICE_TYPE_CPU;
+	else if (arg == "gpu")
+		select.type = CL_DEVICE_TYPE_GPU;
+	else if (!arg.empty() && arg.find_first_not_of("0123456789") == string::npos)
+		select.index = atoi(arg.c_str());
 	else
+		select.name = arg;
+	return select;
+}
+
+// first device matching type and name, or the one at index
+static void selectDevice(CLQueue& queue, const CLDeviceSelect& select)
+{
+	auto devices = enumerateDevices();
+	queue.device = nullptr;
+	for (size_t i = 0; i < devices.size() && !queue.device; i++)
 	{
-		for (int i = 0; i < numPlatforms && !cpu.device; i++)
+		if (select.index >= 0 && (int)i != select.index)
+			continue;
+		cl_device_type type;
+		char name[256] = { 0 };
+		clGetDeviceInfo(devices[i].second, CL_DEVICE_TYPE, sizeof(type), &type, nullptr);
+		clGetDeviceInfo(devices[i].second, CL_DEVICE_NAME, sizeof(name) - 1, name, nullptr);
+		if (!(type & select.type) || string(name).find(select.name) == string::npos)
+			continue;
+		queue.platform = devices[i].first;
+		queue.device = devices[i].second;
+	}
+	if (!queue.device)
+		fatalError("No matching OpenCL device found");
+}
+
+void createComputeQueue(CLQueue& queue, const CLDeviceSelect& select, cl_command_queue_properties properties)
+{
+	selectDevice(queue, select);
+
+	cl_int err;
+	cl_context_properties props[] = { CL_CONTEXT_PLATFORM, (cl_context_properties)queue.platform, 0 };
+	queue.context = clCreateContext(props, 1, &queue.device, nullptr, nullptr, &err);
+	clTest(err, "create context");
+	createQueueHandle(queue, properties);
+
+	queue.printInfo();
+}
+
+void createSubDeviceQueues(vector<unique_ptr<CLQueue> >& queues, const CLDeviceSelect& select, int count,
+						   cl_command_queue_properties properties)
+{
+	CLQueue parent;
+	selectDevice(parent, select);
+	cl_uint units = 1;
+	clTest(clGetDeviceInfo(parent.device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(units), &units, nullptr), "compute units");
+	if (count < 1 || (cl_uint)count > units)
+		fatalError("Can't split the device into that many sub-devices");
+
+	cl_device_partition_property props[] = { CL_DEVICE_PARTITION_EQUALLY, (cl_device_partition_property)(units / count), 0 };
+	vector<cl_device_id> ids(units);
+	cl_uint num = 0;
+	clTest(clCreateSubDevices(parent.device, props, units, &ids[0], &num), "create sub-devices");
+	// a remainder of compute units ends up in extra partitions, leave those alone
+	for (cl_uint i = 0; i < num; i++)
+	{
+		if ((int)i >= count)
 		{
-			cpu.device = findCPUDevice(platform[i]);
-			if (cpu.device)
-				cpu.platform = platform[i];
+			clReleaseDevice(ids[i]);
+			continue;
 		}
-		gpu.context = clCreateContext(&renderContextProps(gpu.platform)[0], 1, &gpu.device, nullptr, nullptr, &err);
-		clTest(err, "create context");
-		cl_context_properties props[] = { CL_CONTEXT_PLATFORM, (cl_context_properties)cpu.platform, 0 };
-		cpu.context = clCreateContext(props, 1, &cpu.device, nullptr, nullptr, &err);
+		cl_int err;
+		unique_ptr<CLQueue> queue(new CLQueue);
+		queue->platform = parent.platform;
+		queue->device = ids[i];
+		cl_context_properties ctxProps[] = { CL_CONTEXT_PLATFORM, (cl_context_properties)queue->platform, 0 };
+		queue->context = clCreateContext(ctxProps, 1, &queue->device, nullptr, nullptr, &err);
 		clTest(err, "create context");
+		createQueueHandle(*queue, properties);
+		queue->printInfo();
+		queues.push_back(move(queue));
 	}
-	
-	// create queues
-    cpu.handle = clCreateCommandQueue(cpu.context, cpu.device, 0, &err);
-    clTest(err, "create cpu queue");
-	gpu.handle = clCreateCommandQueue(gpu.context, gpu.device, 0, &err);
-    clTest(err, "create gpu queue");
+}
+
+void createComputeQueue(CLQueue& queue, cl_device_type type, cl_command_queue_properties properties)
+{
+	CLDeviceSelect select;
+	select.type = type;
+	createComputeQueue(queue, select, properties);
+}
+
+CLDeps::~CLDeps()
+{
+	if (lastWrite)
+		clReleaseEvent(lastWrite);
+	for (auto e : reads)
+		clReleaseEvent(e);
+}
+
+void CLDeps::waitFor(vector<cl_event>& list, bool write) const
+{
+	// RAW, WAW
+	if (lastWrite)
+		list.push_back(lastWrite);
+	// WAR
+	if (write)
+		list.insert(list.end(), reads.begin(), reads.end());
+}
+
+void CLDeps::update(cl_event event, bool write)
+{
+	clRetainEvent(event);
+	if (write)
+	{
+		if (lastWrite)
+			clReleaseEvent(lastWrite);
+		for (auto e : reads)
+			clReleaseEvent(e);
+		reads.clear();
+		lastWrite = event;
+	}
+	else
+	{
+		// buffers read many times between writes would collect events without
+		// bound, drop the finished ones once the list gets long
+		if (reads.size() >= pruneReads)
+		{
+			auto done = remove_if(reads.begin(), reads.end(), [](cl_event e) {
+				cl_int status = CL_QUEUED;
+				clGetEventInfo(e, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, nullptr);
+				if (status != CL_COMPLETE && status >= 0)
+					return false;
+				clReleaseEvent(e);
+				return true;
+			});
+			reads.erase(done, reads.end());
+		}
+		reads.push_back(event);
+	}
+}
+
+void CLDeps::swap(CLDeps& other)
+{
+	std::swap(lastWrite, other.lastWrite);
+	reads.swap(other.reads);
+}
+
+size_t CLMemPool::sizeClass(size_t bytes)
+{
+	if (bytes <= 256)
+		return 256;
+	size_t top = 256;
+	while (top * 2 <= bytes)
+		top *= 2;
+	size_t step = top / 4;
+	return (bytes + step - 1) / step * step;
+}
+
+CLMemPool::~CLMemPool()
+{
+	trim();
+}
+
+cl_mem CLMemPool::alloc(cl_context context, size_t bytes, cl_mem_flags flags, CLDeps& deps)
+{
+	Key key(flags, sizeClass(bytes));
+	cl_mem mem;
+	auto& blocks = cache[key];
+	if (!blocks.empty())
+	{
+		mem = blocks.back().mem;
+		deps.swap(*blocks.back().deps);
+		blocks.pop_back();
+		stats.cached -= key.second;
+		stats.reuses++;
+	}
+	else
+	{
+		cl_int err;
+		mem = clCreateBuffer(context, flags, key.second, nullptr, &err);
+		if (err == CL_MEM_OBJECT_ALLOCATION_FAILURE || err == CL_OUT_OF_RESOURCES)
+		{
+			// the cache may be what's holding the memory
+			trim();
+			mem = clCreateBuffer(context, flags, key.second, nullptr, &err);
+		}
+		clTest(err, "create cl buffer");
+		stats.allocs++;
+	}
+	owned[mem] = key;
+	stats.live += key.second;
+	stats.peak = max(stats.peak, stats.live);
+	return mem;
+}
+
+void CLMemPool::free(cl_mem mem, CLDeps& deps)
+{
+	auto it = owned.find(mem);
+	if (it == owned.end())
+	{
+		clReleaseMemObject(mem);
+		return;
+	}
+	Key key = it->second;
+	owned.erase(it);
+	Block block { mem, unique_ptr<CLDeps>(new CLDeps) };
+	block.deps->swap(deps);
+	cache[key].push_back(move(block));
+	stats.live -= key.second;
+	stats.cached += key.second;
+
+	// over the limit: drop the oldest blocks of the largest size class first,
+	// the driver defers the release until pending commands are done
+	while (stats.cached > maxCached)
+	{
+		auto largest = cache.end();
+		for (auto it = cache.begin(); it != cache.end(); ++it)
+			if (!it->second.empty() && (largest == cache.end() || it->first.second > largest->first.second))
+				largest = it;
+		auto& blocks = largest->second;
+		clReleaseMemObject(blocks.front().mem);
+		blocks.erase(blocks.begin());
+		stats.cached -= largest->first.second;
+	}
+}
+
+void CLMemPool::trim()
+{
+	for (auto& c : cache)
+	{
+		for (auto& b : c.second)
+			clReleaseMemObject(b.mem);
+	}
+	cache.clear();
+	stats.cached = 0;
+}
+
+void CLMemPool::printStats(ostream& str) const
+{
+	const double mb = 1.0 / (1024 * 1024);
+	str << "Device memory pool: " << stats.live * mb << " MB live, " << stats.peak * mb << " MB peak, "
+		<< stats.cached * mb << " MB cached, " << stats.allocs << " allocations, " << stats.reuses << " reuses" << endl;
+}
+
+void CLCommand::prepare()
+{
+	needEvent = queue.profiler != nullptr || keep;
+	if (!queue.outOfOrder)
+		return;
+
+	// commands with unknown dependencies run in isolation
+	if (isUntracked)
+	{
+		clTest(clEnqueueBarrierWithWaitList(queue.handle, 0, nullptr, nullptr), "barrier");
+		return;
+	}
+	for (auto& a : access)
+		a.first->waitFor(waitList, a.second);
+	sort(waitList.begin(), waitList.end());
+	waitList.erase(unique(waitList.begin(), waitList.end()), waitList.end());
+	needEvent = true;
+}
+
+void CLCommand::complete(const string& name)
+{
+	if (queue.outOfOrder)
+	{
+		if (isUntracked)
+			clTest(clEnqueueBarrierWithWaitList(queue.handle, 0, nullptr, nullptr), "barrier");
+		else
+		{
+			for (auto& a : access)
+				a.first->update(evt, a.second);
+		}
+	}
+	if (keep && evt)
+	{
+		clRetainEvent(evt);
+		kept = evt;
+	}
+	if (queue.profiler)
+		queue.profiler->record(name, evt);
+	else if (evt)
+		clReleaseEvent(evt);
+	evt = nullptr;
+}
 
-	cpu.printInfo();
-	gpu.printInfo();
+CLEvent& CLEvent::operator=(CLEvent&& other)
+{
+	if (this != &other)
+	{
+		if (handle)
+			clReleaseEvent(handle);
+		handle = other.handle;
+		other.handle = nullptr;
+	}
+	return *this;
+}
+
+CLEvent::~CLEvent()
+{
+	if (handle)
+		clReleaseEvent(handle);
+}
+
+void CLEvent::wait()
+{
+	if (!handle)
+		return;
+	clTest(clWaitForEvents(1, &handle), "wait for event");
+	clReleaseEvent(handle);
+	handle = nullptr;
+}
+
+bool CLEvent::done() const
+{
+	if (!handle)
+		return true;
+	cl_int status;
+	clTest(clGetEventInfo(handle, CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(status), &status, nullptr), "event status");
+	return status == CL_COMPLETE;
 }
 
 map<string, CLProgram> CLProgram::instances;
+CLDefines CLProgram::defines;
+string CLProgram::cacheDir = "clcache";
+
+static void makeDirectory(const string& path)
+{
+#if defined (_WIN32)
+	_mkdir(path.c_str());
+#else
+	mkdir(path.c_str(), 0755);
+#endif
+}
+
+static string readFile(const string& pathName)
+{
+	ifstream file(pathName.c_str(), ios::binary);
+	if (!file.is_open())
+		return string();
+	return string(istreambuf_iterator<char>(file), (istreambuf_iterator<char>()));
+}
+
+// the source with the contents of every header it pulls in from src/opencl
+static void collectSources(const string& filename, string& all, vector<string>& seen)
+{
+	if (find(seen.begin(), seen.end(), filename) != seen.end())
+		return;
+	seen.push_back(filename);
+	string text = readFile("src/opencl/" + filename);
+	all += text;
+
+	istringstream lines(text);
+	string line;
+	while (getline(lines, line))
+	{
+		size_t inc = line.find("#include");
+		size_t open = line.find('"', inc);
+		size_t close = line.find('"', open + 1);
+		if (inc != string::npos && open != string::npos && close != string::npos)
+			collectSources(line.substr(open + 1, close - open - 1), all, seen);
+	}
+}
 
-CLProgram& CLProgram::get(CLQueue& queue, const std::string& filename) 
+// FNV-1a, only used to name cache files
+static unsigned long long hashString(const string& text)
 {
-	auto it = instances.find(filename);
+	unsigned long long hash = 14695981039346656037ULL;
+	for (unsigned char c : text)
+	{
+		hash ^= c;
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static string deviceString(cl_device_id device, cl_device_info param)
+{
+	char value[256] = { 0 };
+	clGetDeviceInfo(device, param, sizeof(value) - 1, value, nullptr);
+	return value;
+}
+
+// one binary per device: sources, options, device and driver
+static string binaryCacheFile(const string& sources, const string& options, cl_device_id device)
+{
+	string key = sources + "\n" + options + "\n" + deviceString(device, CL_DEVICE_NAME) + "\n" + 
+		deviceString(device, CL_DEVICE_VERSION) + "\n" + deviceString(device, CL_DRIVER_VERSION);
+	ostringstream name;
+	name << CLProgram::cacheDir << "/" << hex << hashString(key) << ".bin";
+	return name.str();
+}
+
+static bool buildFromBinaries(CLProgram& prog, CLQueue& queue, const vector<cl_device_id>& devices,
+	const vector<string>& files, const string& options)
+{
+	vector<string> binaries;
+	for (auto& f : files)
+	{
+		binaries.push_back(readFile(f));
+		if (binaries.back().empty())
+			return false;
+	}
+	vector<size_t> sizes;
+	vector<const unsigned char*> ptrs;
+	for (auto& b : binaries)
+	{
+		sizes.push_back(b.size());
+		ptrs.push_back((const unsigned char*)b.data());
+	}
+
+	cl_int err;
+	vector<cl_int> status(devices.size());
+	prog.handle = clCreateProgramWithBinary(queue.context, (cl_uint)devices.size(), &devices[0], &sizes[0], 
+		&ptrs[0], &status[0], &err);
+	if (err != CL_SUCCESS)
+		return false;
+	// stale or foreign binaries are not an error, the source is still there
+	if (clBuildProgram(prog.handle, (cl_uint)devices.size(), &devices[0], options.c_str(), nullptr, nullptr) != CL_SUCCESS)
+	{
+		clReleaseProgram(prog.handle);
+		prog.handle = nullptr;
+		return false;
+	}
+	return true;
+}
+
+static void storeBinaries(CLProgram& prog, const vector<cl_device_id>& devices, const vector<string>& files)
+{
+	// binaries come in the program's device order
+	cl_uint numDevices = 0;
+	clGetProgramInfo(prog.handle, CL_PROGRAM_NUM_DEVICES, sizeof(numDevices), &numDevices, nullptr);
+	vector<cl_device_id> progDevices(numDevices);
+	vector<size_t> sizes(numDevices);
+	clGetProgramInfo(prog.handle, CL_PROGRAM_DEVICES, numDevices * sizeof(cl_device_id), &progDevices[0], nullptr);
+	if (clGetProgramInfo(prog.handle, CL_PROGRAM_BINARY_SIZES, numDevices * sizeof(size_t), &sizes[0], nullptr) != CL_SUCCESS)
+		return;
+	vector<vector<unsigned char> > binaries(numDevices);
+	vector<unsigned char*> ptrs(numDevices);
+	for (cl_uint i = 0; i < numDevices; i++)
+	{
+		binaries[i].resize(sizes[i]);
+		ptrs[i] = sizes[i] ? &binaries[i][0] : nullptr;
+	}
+	if (clGetProgramInfo(prog.handle, CL_PROGRAM_BINARIES, numDevices * sizeof(unsigned char*), &ptrs[0], nullptr) != CL_SUCCESS)
+		return;
+
+	makeDirectory(CLProgram::cacheDir);
+	for (size_t d = 0; d < devices.size(); d++)
+	{
+		auto it = find(progDevices.begin(), progDevices.end(), devices[d]);
+		size_t i = it - progDevices.begin();
+		if (it == progDevices.end() || sizes[i] == 0)
+			continue;
+		// write and rename, so concurrent runs never see half a file
+		string tmp = files[d] + ".tmp";
+		{
+			ofstream file(tmp.c_str(), ios::binary);
+			file.write((const char*)&binaries[i][0], sizes[i]);
+			if (!file)
+				continue;
+		}
+		remove(files[d].c_str());
+		rename(tmp.c_str(), files[d].c_str());
+	}
+}
+
+CLProgram& CLProgram::get(CLQueue& queue, const std::string& filename, const CLDefines& extra) 
+{
+	CLDefines all = extra;
+	all.insert(defines.begin(), defines.end());
+	string includes = "-I src/opencl";
+	for (auto& define : all)
+		includes += " -D " + define.first + "=" + define.second;
+
+	// the same file built with other defines, or for another context, is a separate program
+	ostringstream key;
+	key << queue.context << " " << filename << " " << includes;
+	auto it = instances.find(key.str());
 	if (it != instances.end()) 
 		return it->second;
 
-	instances[filename] = CLProgram();
-	CLProgram& prog = instances[filename];
+	CLProgram& prog = instances[key.str()];
+	prog.options = includes;
 
 	string pathName = "src/opencl/" + filename;
-	string includes = "-I src/opencl";
-	fstream file(pathName.c_str());
-	if (!file.is_open())
+	string buffer = readFile(pathName);
+	if (buffer.empty())
 		fatalError("Can't load OpenCL kernel " + filename);
-	string buffer (istreambuf_iterator<char>(file), (istreambuf_iterator<char>()));
+
+	// cached binaries for all devices of the context, or build from source and store them
+	vector<cl_device_id> devices;
+	vector<string> cacheFiles;
+	if (!cacheDir.empty())
+	{
+		cl_uint numDevices = 0;
+		clTest(clGetContextInfo(queue.context, CL_CONTEXT_NUM_DEVICES, sizeof(numDevices), &numDevices, nullptr), 
+			"context devices");
+		devices.resize(numDevices);
+		clTest(clGetContextInfo(queue.context, CL_CONTEXT_DEVICES, numDevices * sizeof(cl_device_id), &devices[0], nullptr),
+			"context devices");
+
+		string sources;
+		vector<string> seen;
+		collectSources(filename, sources, seen);
+		for (auto device : devices)
+			cacheFiles.push_back(binaryCacheFile(sources, includes, device));
+		if (buildFromBinaries(prog, queue, devices, cacheFiles, includes))
+			return prog;
+	}
 
 	// compile program
 	cl_int err;
@@ -276,24 +702,154 @@ CLProgram& CLProgram::get(CLQueue& queue, const std::string& filename)
  		cerr << "Build log: " << buffer << endl;
  		fatalError("Build failed");
 	}
+	if (!cacheDir.empty())
+		storeBinaries(prog, devices, cacheFiles);
 	return prog;
 }
 
-CLKernel::CLKernel(CLQueue& queue, const string& filename, const string& kernel) :
-	queue(queue), program(CLProgram::get(queue, filename))
+CLKernel::CLKernel(CLQueue& queue, const string& filename, const string& kernel, const CLDefines& defines) :
+	queue(queue), program(CLProgram::get(queue, filename, defines)), name(kernel)
 {
 	cl_int err;
 	handle = clCreateKernel(program.handle, kernel.c_str(), &err);
 	clTest(err, "Can't create kernel " + kernel);
 }
 
+bool CLKernel::autotune = false;
+
+static int log2Floor(size_t n)
+{
+	int lg = 0;
+	while (n >>= 1)
+		lg++;
+	return lg;
+}
+
+CLKernel::Tuning& CLKernel::tuning(size_t problem_size)
+{
+	const int sizeClass = log2Floor(max(problem_size, (size_t)1));
+	Tuning& t = tunings[sizeClass];
+	if (t.best || !t.candidates.empty())
+		return t;
+
+	size_t maxLocal = 1, multiple = 1;
+	clTest(clGetKernelWorkGroupInfo(handle, queue.device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(maxLocal), &maxLocal, nullptr), "kernel info");
+	clTest(clGetKernelWorkGroupInfo(handle, queue.device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(multiple), &multiple, nullptr), "kernel info");
+	multiple = max(multiple, (size_t)1);
+	maxLocal = max(min(maxLocal, (size_t)1024), multiple);
+
+	// builds with other defines are different kernels and tune separately
+	stringstream key;
+	key << "wg." << name << "." << hex << hashString(program.options) << dec << "." << sizeClass;
+	t.key = key.str();
+	int stored;
+	if (TuneCache::get().lookup(queue, t.key, stored) && stored > 0 && (size_t)stored <= maxLocal)
+	{
+		t.best = stored;
+		return t;
+	}
+	if (!autotune)
+	{
+		// 64 rounded to the preferred multiple
+		t.best = min((64 + multiple - 1) / multiple * multiple, maxLocal);
+		return t;
+	}
+	// multiples of the preferred size doubling from 16 work-items up, no larger than the problem
+	size_t start = (16 + multiple - 1) / multiple * multiple;
+	for (size_t c = min(start, maxLocal); c <= maxLocal; c *= 2)
+	{
+		t.candidates.push_back(c);
+		if (c >= problem_size)
+			break;
+	}
+	t.times.assign(t.candidates.size(), 1e30);
+	return t;
+}
+
+size_t CLKernel::autoLocal(size_t problem_size)
+{
+	Tuning& t = tuning(problem_size);
+	if (t.best)
+		return t.best;
+	return t.candidates[t.runs % t.candidates.size()];
+}
+
 void CLKernel::enqueue(size_t problem_size, size_t local)
 {
+	// still trying sizes: time this launch on its own
+	Tuning* tune = nullptr;
+	if (local == 0)
+	{
+		local = autoLocal(problem_size);
+		Tuning& t = tuning(problem_size);
+		if (!t.best)
+			tune = &t;
+	}
+	chrono::high_resolution_clock::time_point start;
+	if (tune)
+	{
+		clFinish(queue.handle);
+		start = chrono::high_resolution_clock::now();
+	}
+
 	// align blocks to multiples of local
 	size_t blocks = max((size_t)1, (problem_size / local) + (!(problem_size % local) ? 0 : 1));
 	problem_size = blocks * local;
 	
+	CLCommand cmd(queue);
+	for (auto& a : argDeps)
+	{
+		if (a.untracked)
+			cmd.untracked();
+		else if (a.deps)
+			a.write ? cmd.write(*a.deps) : cmd.read(*a.deps);
+	}
+	cmd.prepare();
 	cl_int err = clEnqueueNDRangeKernel(queue.handle, handle, 1, nullptr, &problem_size,
-		&local, 0, nullptr, nullptr);
-	clTest(err, "Can't enqueue kernel");
+		&local, cmd.numWait(), cmd.wait(), cmd.event());
+	clTest(err, "Can't enqueue kernel " + name);
+	cmd.complete(name);
+
+	if (tune)
+	{
+		clFinish(queue.handle);
+		double time = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+		// best of three launches per candidate
+		const size_t idx = tune->runs++ % tune->candidates.size();
+		tune->times[idx] = min(tune->times[idx], time);
+		if (tune->runs == 3 * (int)tune->candidates.size())
+		{
+			size_t best = min_element(tune->times.begin(), tune->times.end()) - tune->times.begin();
+			tune->best = tune->candidates[best];
+			TuneCache::get().store(queue, tune->key, (int)tune->best);
+		}
+	}
+}
+
+bool CLKernel::argChanged(int idx, const void* value, size_t size)
+{
+	if (idx >= (int)argValues.size())
+		argValues.resize(idx + 1);
+	string& cached = argValues[idx];
+	const char tag = value ? 'V' : 'L';
+	const size_t bytes = value ? size : sizeof(size);
+	const void* data = value ? value : &size;
+	if (cached.size() == bytes + 1 && cached[0] == tag && memcmp(&cached[1], data, bytes) == 0)
+		return false;
+	cached.assign(1, tag);
+	cached.append((const char*)data, bytes);
+	return true;
+}
+
+void CLCommandList::run() const
+{
+	for (auto& c : commands)
+		c();
+}
+
+void CLKernel::setArgDeps(int idx, CLDeps* deps, bool write, bool untracked)
+{
+	if (idx >= (int)argDeps.size())
+		argDeps.resize(idx + 1, { nullptr, false, false });
+	argDeps[idx] = { deps, write, untracked };
 }
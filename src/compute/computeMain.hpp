@@ -7,12 +7,77 @@
 #include <map>
 #include <cassert>
 #include <memory>
-#include "render/vertexArray.hpp"
+#include <algorithm>
+#include <functional>
+#include <tuple>
+#include <utility>
+#include <iosfwd>
+#include <string>
 #include "compute/opencl.hpp"
+#include "compute/profiler.hpp"
 #include "tools/log.hpp"
 
 void clTest(cl_int err, const std::string& msg);
 
+// Commands a buffer's next access has to wait for on an out-of-order queue
+class CLDeps
+{
+public:
+	CLDeps() {}
+	CLDeps(const CLDeps&) = delete;
+	~CLDeps();
+	void waitFor(std::vector<cl_event>& list, bool write) const;
+	void update(cl_event event, bool write);
+	void swap(CLDeps& other);
+
+protected:
+	cl_event lastWrite = nullptr;
+	std::vector<cl_event> reads; // since last write, finished ones pruned
+	static const size_t pruneReads = 16;
+};
+
+// Recycles device buffers in size classes of a quarter power of two. Freed
+// buffers keep their pending accesses, so reuse is ordered after them. The
+// cache holds at most maxCached bytes.
+class CLMemPool
+{
+public:
+	struct Stats
+	{
+		size_t live = 0, peak = 0; // bytes handed out, rounded to the size class
+		size_t cached = 0;         // bytes held for reuse
+		int allocs = 0, reuses = 0;
+	};
+
+	CLMemPool() {}
+	CLMemPool(const CLMemPool&) = delete;
+	~CLMemPool();
+
+	// buffer of at least bytes, deps takes over the accesses of its last user
+	cl_mem alloc(cl_context context, size_t bytes, cl_mem_flags flags, CLDeps& deps);
+	// handles not from the pool are released directly
+	void free(cl_mem mem, CLDeps& deps);
+	// give all cached buffers back to the driver
+	void trim();
+	// cache limit in bytes, free() releases the largest blocks beyond it
+	size_t maxCached = 256 << 20;
+	void printStats(std::ostream& str) const;
+
+	static size_t sizeClass(size_t bytes);
+
+	Stats stats;
+
+protected:
+	typedef std::pair<cl_mem_flags, size_t> Key;
+	struct Block
+	{
+		cl_mem mem;
+		std::unique_ptr<CLDeps> deps;
+	};
+	std::map<Key, std::vector<Block>> cache;
+	std::map<cl_mem, Key> owned;
+};
+
 class CLQueue
 {
 public:
@@ -20,18 +85,56 @@ public:
 	cl_device_id device;
 	cl_context context;
 	cl_command_queue handle;
+	CLProfiler* profiler = nullptr;
+	bool outOfOrder = false;
+	bool sharesGL = false; // context created with GL sharing, CLVertexBuffer works
+	CLMemPool pool; // backs all CLBuffers of this queue
 
 	void printInfo();
 };
 
-void createQueues(CLQueue& cpuQueue, CLQueue& gpuQueue);
+// which device createComputeQueue picks: the first one matching type and name
+struct CLDeviceSelect
+{
+	cl_device_type type = CL_DEVICE_TYPE_ALL;
+	std::string name;  // substring of the device name
+	int index = -1;    // position in listDevices, -1: any
+
+	// "cpu", "gpu", an index or a name
+	static CLDeviceSelect parse(const std::string& arg);
+};
+
+// all devices of all platforms, numbered
+void listDevices(std::ostream& str);
+
+// plain compute context without GL sharing, works headless; see glInterop.hpp for the shared one
+void createComputeQueue(CLQueue& queue, const CLDeviceSelect& select, cl_command_queue_properties properties = 0);
+void createComputeQueue(CLQueue& queue, cl_device_type type = CL_DEVICE_TYPE_ALL, 
+						cl_command_queue_properties properties = 0);
+
+// equal partitions of one device by clCreateSubDevices, each with its own context and queue
+void createSubDeviceQueues(std::vector<std::unique_ptr<CLQueue> >& queues, const CLDeviceSelect& select, int count,
+						   cl_command_queue_properties properties = 0);
+
+// command queue on queue.context and queue.device
+void createQueueHandle(CLQueue& queue, cl_command_queue_properties properties);
+
+// preprocessor defines, name -> value
+typedef std::map<std::string, std::string> CLDefines;
 
 class CLProgram
 {
 public:
-	static CLProgram& get(CLQueue& queue, const std::string& filename);
+	// one program per context, file and defines; extra ones win over the global ones
+	static CLProgram& get(CLQueue& queue, const std::string& filename, const CLDefines& extra = CLDefines());
+
+	// preprocessor defines for all programs built from now on, e.g. defines["MORTON_HASH"] = "1"
+	static CLDefines defines;
+	// directory for compiled program binaries, empty: always build from source
+	static std::string cacheDir;
 
 	cl_program handle;
+	std::string options; // build options, includes and defines
 
 protected:
 	static std::map<std::string, CLProgram> instances;
@@ -43,24 +146,123 @@ struct LocalBlock
 	int size;
 };
 
+// Completion of an asynchronous command, released with the object
+class CLEvent
+{
+public:
+	CLEvent(cl_event handle = nullptr) : handle(handle) {}
+	CLEvent(CLEvent&& other) : handle(other.handle) { other.handle = nullptr; }
+	CLEvent& operator=(CLEvent&& other);
+	CLEvent(const CLEvent&) = delete;
+	~CLEvent();
+
+	void wait();
+	bool done() const;
+	// hands the handle over to the caller
+	cl_event release() { cl_event e = handle; handle = nullptr; return e; }
+
+	cl_event handle;
+};
+
+// Wait list and event bookkeeping of a single enqueued command
+class CLCommand
+{
+public:
+	CLCommand(CLQueue& queue) : queue(queue) {}
+	void read(CLDeps& deps) { access.push_back({ &deps, false }); }
+	void write(CLDeps& deps) { access.push_back({ &deps, true }); }
+	void untracked() { isUntracked = true; }
+	// the caller gets the event, see takeEvent
+	void keepEvent() { keep = true; }
+
+	// call before enqueueing, returns wait list to pass on
+	void prepare();
+	cl_uint numWait() const { return (cl_uint)waitList.size(); }
+	const cl_event* wait() const { return waitList.empty() ? nullptr : &waitList[0]; }
+	cl_event* event() { return needEvent ? &evt : nullptr; }
+	void complete(const std::string& name);
+	// after complete, with keepEvent
+	CLEvent takeEvent() { CLEvent e(kept); kept = nullptr; return e; }
+	~CLCommand() { if (kept) clReleaseEvent(kept); }
+
+protected:
+	CLQueue& queue;
+	std::vector<std::pair<CLDeps*, bool> > access;
+	std::vector<cl_event> waitList;
+	cl_event evt = nullptr;
+	bool needEvent = false;
+	bool isUntracked = false;
+	bool keep = false;
+	cl_event kept = nullptr;
+};
+
+template<class T> class CLBuffer;
+template<class T> class CLConstBuffer;
+
+// Kernel argument that is only read; plain buffer arguments count as read and written
+template<class T>
+struct ReadOnly
+{
+	ReadOnly(CLBuffer<T>& buffer) : buffer(buffer) {}
+	CLBuffer<T>& buffer;
+};
+
+template<class T> inline ReadOnly<T> readOnly(CLBuffer<T>& buffer) { return ReadOnly<T>(buffer); }
+
 class CLKernel
 {
 public:
-	CLKernel(CLQueue& queue, const std::string& filename, const std::string& kernel);
+	CLKernel(CLQueue& queue, const std::string& filename, const std::string& kernel, 
+		const CLDefines& defines = CLDefines());
 	template<class T> inline void setArg(int idx, const T& value);
+	template<class T> inline void setArg(int idx, const CLBuffer<T>& value);
+	template<class T> inline void setArg(int idx, const ReadOnly<T>& value);
+	template<class T> inline void setArg(int idx, const CLConstBuffer<T>& value);
 	template<typename T, typename... Args> void setArgs(const T& value, const Args &... args);
 	template<typename T, typename... Args> void call(size_t problem_size, size_t local, const T& value, const Args &... args);
+	// local 0: tuned work-group size, only for kernels that don't depend on it
 	void enqueue(size_t problem_size, size_t local = 1);
+	size_t autoLocal(size_t problem_size);
+
+	// time the candidate sizes on the first launches of each kernel and problem
+	// size class, winners are stored in the TuneCache and used by later runs.
+	// Off, local size 0 takes a stored winner or 64 rounded to the preferred multiple.
+	static bool autotune;
 	
 	CLQueue& queue;
 	CLProgram& program;
 	cl_kernel handle;	
+	std::string name;
 private:
+	struct Tuning
+	{
+		std::vector<size_t> candidates;
+		std::vector<double> times;
+		std::string key; // in the TuneCache
+		int runs = 0;
+		size_t best = 0;
+	};
+	Tuning& tuning(size_t problem_size);
+	std::map<int, Tuning> tunings; // by log2 of the problem size
+
 	template<typename T, typename... Args> inline void _setArgs(int idx, const T& value, const Args &... args);
 	inline void _setArgs(int idx);
+	void setArgDeps(int idx, CLDeps* deps, bool write, bool untracked = false);
+	// false if the kernel already holds this value, the clSetKernelArg can be skipped
+	bool argChanged(int idx, const void* value, size_t size);
+	std::vector<std::string> argValues; // bytes last set per argument, 'V' or 'L' (local size) first
+
+	struct ArgDeps
+	{
+		CLDeps* deps;
+		bool write, untracked;
+	};
+	std::vector<ArgDeps> argDeps;
 };
 
-enum class BufferType { None = 0, Host = 1, Gpu = 2, Both = 3 };
+// Pinned: device buffer in host-accessible memory (CL_MEM_ALLOC_HOST_PTR), read
+// and written through map/unmap. Zero-copy on CPU devices and integrated GPUs.
+enum class BufferType { None = 0, Host = 1, Gpu = 2, Both = 3, Pinned = 4 };
 
 template<class T>
 class CLBuffer
@@ -69,31 +271,35 @@ public:
 	CLBuffer(CLQueue& queue, int size, BufferType type);
 	CLBuffer(CLQueue& queue) : queue(queue) {}
 	virtual ~CLBuffer();
-	void upload();
-	void download();
+	// the first count elements, all by default
+	void upload(size_t count = all);
+	void download(size_t count = all);
+	// non-blocking; leave the host vector alone until the event completed
+	CLEvent uploadAsync(size_t count = all);
+	CLEvent downloadAsync(size_t count = all);
+	// Pinned only: host pointer to the whole buffer, valid until unmap. With
+	// an event the map is non-blocking and the data valid once it completed.
+	T* map(bool write, CLEvent* event = nullptr);
+	void unmap();
 	void swap(CLBuffer<T>& other);
 	void resize(int nsize);
 	void reallocate(int nsize);
 	void fill(const T& value);
+	void fill(const T& value, size_t offset, size_t count);
+	void copyFrom(const CLBuffer<T>& src, size_t count);
 
 	std::vector<T> buffer;
 	BufferType type = BufferType::None;
 	CLQueue& queue;
 	cl_mem handle = 0;
 	size_t size = 0, reserve = 0;
-};
-
-template<class T>
-class CLVertexBuffer : public CLBuffer<T>
-{
-public:
-	CLVertexBuffer(CLQueue& queue, SingleVertexArray& va);
+	mutable CLDeps deps;
+	T* mapped = nullptr;
 
-	void acquire();
-	void release();
-	void grow(int nsize);
+	static const size_t all = (size_t)-1;
 
-	SingleVertexArray& vaLink;
+protected:
+	cl_event transfer(bool write, bool blocking, size_t count);
 };
 
 template<class T>
@@ -102,11 +308,65 @@ class CLConstBuffer
 public:
 	CLConstBuffer(CLQueue& queue);
 	virtual ~CLConstBuffer();
+	// asynchronous, data can be changed again right away
 	void upload();
 	
 	T data;
 	CLQueue& queue;
 	cl_mem handle = 0;
+	mutable CLDeps deps;
+
+protected:
+	T staged; // source of the pending write
+	CLEvent pending;
+};
+
+// Argument as recorded by CLCommandList: buffers by reference, std::ref/cref
+// values by reference, everything else by value
+template<class T>
+struct CLRecordedArg
+{
+	CLRecordedArg(const T& value) : value(value) {}
+	const T& get() const { return value; }
+	T value;
+};
+
+template<class T>
+struct CLRecordedArg<CLBuffer<T> >
+{
+	CLRecordedArg(const CLBuffer<T>& value) : ptr(&value) {}
+	const CLBuffer<T>& get() const { return *ptr; }
+	const CLBuffer<T>* ptr;
+};
+
+template<class T>
+struct CLRecordedArg<std::reference_wrapper<T> >
+{
+	CLRecordedArg(const std::reference_wrapper<T>& value) : ref(value) {}
+	T& get() const { return ref.get(); }
+	std::reference_wrapper<T> ref;
+};
+
+// Kernel launches recorded once and replayed by run(). Together with the
+// argument caching in CLKernel a replay only re-sets what changed, e.g. a
+// buffer swapped with CLBuffer::swap or a value passed as std::cref.
+class CLCommandList
+{
+public:
+	template<typename G, typename... Args> 
+	void add(CLKernel& kernel, const G& problem_size, size_t local, const Args&... args);
+	template<class T> void fill(CLBuffer<T>& buffer, const T& value);
+	void add(const std::function<void()>& fn) { commands.push_back(fn); }
+
+	void run() const;
+	void clear() { commands.clear(); }
+	bool empty() const { return commands.empty(); }
+
+private:
+	template<typename Tuple, size_t... I>
+	static void replay(CLKernel& kernel, size_t local, const Tuple& args, std::index_sequence<I...>);
+
+	std::vector<std::function<void()> > commands;
 };
 
 // ------------------------------------
@@ -117,11 +377,10 @@ template<class T>
 CLBuffer<T>::CLBuffer(CLQueue& queue, int size, BufferType type) : 
 	queue(queue), type(type), size(size), reserve(size)
 {
-	cl_int err;
-	if (type == BufferType::Gpu || type == BufferType::Both)
+	if (type == BufferType::Gpu || type == BufferType::Both || type == BufferType::Pinned)
 	{
-		this->handle = clCreateBuffer(queue.context, CL_MEM_READ_WRITE, sizeof(T)*size, nullptr, &err);
-		clTest(err, "create cl buffer");
+		cl_mem_flags flags = CL_MEM_READ_WRITE | (type == BufferType::Pinned ? CL_MEM_ALLOC_HOST_PTR : 0);
+		this->handle = queue.pool.alloc(queue.context, sizeof(T)*size, flags, deps);
 	}
 	if (type == BufferType::Host || type == BufferType::Both)
 	{
@@ -132,25 +391,96 @@ CLBuffer<T>::CLBuffer(CLQueue& queue, int size, BufferType type) :
 template<class T>
 CLBuffer<T>::~CLBuffer()
 {
-	clReleaseMemObject(this->handle);
+	if (this->handle)
+		queue.pool.free(this->handle, deps);
 }
 
 template<class T>
-void CLBuffer<T>::download()
+cl_event CLBuffer<T>::transfer(bool write, bool blocking, size_t count)
 {
 	if (type != BufferType::Both)
-		fatalError("Try to read from a Host/GPU only buffer");
-	clTest(clEnqueueReadBuffer(queue.handle, handle, CL_TRUE, 0, sizeof(T)*size, 
-							   &buffer[0], 0, nullptr, nullptr), "read buffer");
+		fatalError(write ? "Try to write to a Host/GPU only buffer" : "Try to read from a Host/GPU only buffer");
+	CLCommand cmd(queue);
+	if (write)
+		cmd.write(deps);
+	else
+		cmd.read(deps);
+	if (!blocking)
+		cmd.keepEvent();
+	cmd.prepare();
+	cl_bool block = blocking ? CL_TRUE : CL_FALSE;
+	const size_t bytes = sizeof(T) * std::min(count, size);
+	if (write)
+		clTest(clEnqueueWriteBuffer(queue.handle, handle, block, 0, bytes,
+									&buffer[0], cmd.numWait(), cmd.wait(), cmd.event()), "write buffer");
+	else
+		clTest(clEnqueueReadBuffer(queue.handle, handle, block, 0, bytes,
+								   &buffer[0], cmd.numWait(), cmd.wait(), cmd.event()), "read buffer");
+	cmd.complete(write ? "write buffer" : "read buffer");
+	return cmd.takeEvent().release();
 }
 
 template<class T>
-void CLBuffer<T>::upload()
+void CLBuffer<T>::download(size_t count)
 {
-	if (type != BufferType::Both)
-		fatalError("Try to write to a Host/GPU only buffer");
-	clTest(clEnqueueWriteBuffer(queue.handle, handle, CL_TRUE, 0, sizeof(T)*size,
-						 	    &buffer[0], 0, nullptr, nullptr), "write buffer");
+	transfer(false, true, count);
+}
+
+template<class T>
+void CLBuffer<T>::upload(size_t count)
+{
+	transfer(true, true, count);
+}
+
+template<class T>
+CLEvent CLBuffer<T>::downloadAsync(size_t count)
+{
+	return CLEvent(transfer(false, false, count));
+}
+
+template<class T>
+CLEvent CLBuffer<T>::uploadAsync(size_t count)
+{
+	return CLEvent(transfer(true, false, count));
+}
+
+template<class T>
+T* CLBuffer<T>::map(bool write, CLEvent* event)
+{
+	if (type != BufferType::Pinned)
+		fatalError("Try to map a non-pinned buffer");
+	assert(!mapped);
+	CLCommand cmd(queue);
+	if (write)
+		cmd.write(deps);
+	else
+		cmd.read(deps);
+	if (event)
+		cmd.keepEvent();
+	cmd.prepare();
+	cl_int err;
+	mapped = (T*)clEnqueueMapBuffer(queue.handle, handle, event ? CL_FALSE : CL_TRUE, 
+									 write ? CL_MAP_WRITE : CL_MAP_READ, 0, sizeof(T)*size,
+									 cmd.numWait(), cmd.wait(), cmd.event(), &err);
+	clTest(err, "map buffer");
+	cmd.complete("map buffer");
+	if (event)
+		*event = cmd.takeEvent();
+	return mapped;
+}
+
+template<class T>
+void CLBuffer<T>::unmap()
+{
+	if (!mapped)
+		return;
+	CLCommand cmd(queue);
+	// orders kernels after the host writes, and the next map after this one
+	cmd.write(deps);
+	cmd.prepare();
+	clTest(clEnqueueUnmapMemObject(queue.handle, handle, mapped, cmd.numWait(), cmd.wait(), cmd.event()), "unmap buffer");
+	cmd.complete("unmap buffer");
+	mapped = nullptr;
 }
 
 template<class T>
@@ -158,16 +488,19 @@ void CLBuffer<T>::swap(CLBuffer<T>& other)
 {
 	assert(&queue == &other.queue);
 	assert(reserve == other.reserve);	
+	assert(!mapped && !other.mapped);
 	std::swap(handle, other.handle);
 	std::swap(size, other.size);
 	buffer.swap(other.buffer);
+	deps.swap(other.deps);
 }
 
 template<class T>
 void CLBuffer<T>::resize(int nsize)
 {
+	// geometric growth, so slowly rising counts don't reallocate every time
 	if (nsize > reserve)
-		reallocate(nsize);
+		reallocate(std::max((size_t)nsize, reserve + reserve / 2));
 
 	this->size = nsize;
 }
@@ -175,14 +508,15 @@ void CLBuffer<T>::resize(int nsize)
 template<class T>
 void CLBuffer<T>::reallocate(int nreserve)
 {
-	cl_int err;
-	if (type == BufferType::Gpu || type == BufferType::Both)
+	if (type == BufferType::Gpu || type == BufferType::Both || type == BufferType::Pinned)
 	{
-		if (this->reserve > 0)
-			clReleaseMemObject(this->handle);
+		assert(!mapped);
+		if (this->handle)
+			queue.pool.free(this->handle, deps);
+		this->handle = 0;
+		cl_mem_flags flags = CL_MEM_READ_WRITE | (type == BufferType::Pinned ? CL_MEM_ALLOC_HOST_PTR : 0);
 		if (nreserve > 0)
-			this->handle = clCreateBuffer(queue.context, CL_MEM_READ_WRITE, sizeof(T)*nreserve, nullptr, &err);
-		clTest(err, "create cl");
+			this->handle = queue.pool.alloc(queue.context, sizeof(T)*nreserve, flags, deps);
 	}
 	if (type == BufferType::Host || type == BufferType::Both)
 	{
@@ -194,61 +528,79 @@ void CLBuffer<T>::reallocate(int nreserve)
 template<class T>
 void CLBuffer<T>::fill(const T& val)
 {
-	clTest(clEnqueueFillBuffer(queue.handle, this->handle, &val, sizeof(T), 0, size*sizeof(T), 0, 0, 0), "fill buffer");
+	fill(val, 0, size);
 }
 
 template<class T>
-CLVertexBuffer<T>::CLVertexBuffer(CLQueue& queue, SingleVertexArray& va) :
-	CLBuffer(queue), vaLink(va)
-{
-	cl_int err;
-	this->type = BufferType::Gpu;
-	this->size = va.buffer.size / sizeof(T);
-	this->reserve = va.buffer.size / sizeof(T);
-	this->handle = clCreateFromGLBuffer(queue.context, CL_MEM_WRITE_ONLY, va.buffer.handle, &err);
-	clTest(err, "create cl/gl buffer");
+void CLBuffer<T>::fill(const T& val, size_t offset, size_t count)
+{
+	CLCommand cmd(queue);
+	cmd.write(deps);
+	cmd.prepare();
+	clTest(clEnqueueFillBuffer(queue.handle, this->handle, &val, sizeof(T), offset*sizeof(T), count*sizeof(T), 
+							   cmd.numWait(), cmd.wait(), cmd.event()), "fill buffer");
+	cmd.complete("fill");
 }
 
 template<class T>
-inline void CLKernel::setArg(int idx, const T& value)
-{
-	clTest(clSetKernelArg(handle, idx, sizeof(T), (void*)&value), "set arg");
+void CLBuffer<T>::copyFrom(const CLBuffer<T>& src, size_t count)
+{
+	CLCommand cmd(queue);
+	cmd.read(src.deps);
+	cmd.write(deps);
+	cmd.prepare();
+	clTest(clEnqueueCopyBuffer(queue.handle, src.handle, handle, 0, 0, count*sizeof(T),
+							   cmd.numWait(), cmd.wait(), cmd.event()), "copy buffer");
+	cmd.complete("copy");
 }
 
-template<>
-inline void CLKernel::setArg<LocalBlock>(int idx, const LocalBlock& value)
+template<class T>
+inline void CLKernel::setArg(int idx, const T& value)
 {
-	clTest(clSetKernelArg(handle, idx, value.size, nullptr), "set arg");
+	if (argChanged(idx, &value, sizeof(T)))
+		clTest(clSetKernelArg(handle, idx, sizeof(T), (void*)&value), "set arg");
+	setArgDeps(idx, nullptr, false);
 }
 
 template<>
-inline void CLKernel::setArg<CLBuffer<cl_float> >(int idx, const CLBuffer<cl_float>& value)
+inline void CLKernel::setArg<LocalBlock>(int idx, const LocalBlock& value)
 {
-	clTest(clSetKernelArg(handle, idx, sizeof(cl_mem), (void*)&value.handle), "set arg");
+	if (argChanged(idx, nullptr, value.size))
+		clTest(clSetKernelArg(handle, idx, value.size, nullptr), "set arg");
+	setArgDeps(idx, nullptr, false);
 }
 
+// raw handles can't be tracked, these kernels are fenced with barriers
 template<>
-inline void CLKernel::setArg<CLBuffer<cl_float2> >(int idx, const CLBuffer<cl_float2>& value)
+inline void CLKernel::setArg<cl_mem>(int idx, const cl_mem& value)
 {
-	clTest(clSetKernelArg(handle, idx, sizeof(cl_mem), (void*)&value.handle), "set arg");
+	if (argChanged(idx, &value, sizeof(cl_mem)))
+		clTest(clSetKernelArg(handle, idx, sizeof(cl_mem), (void*)&value), "set arg");
+	setArgDeps(idx, nullptr, false, true);
 }
 
-template<>
-inline void CLKernel::setArg<CLBuffer<cl_uint2> >(int idx, const CLBuffer<cl_uint2>& value)
+template<class T>
+inline void CLKernel::setArg(int idx, const CLBuffer<T>& value)
 {
-	clTest(clSetKernelArg(handle, idx, sizeof(cl_mem), (void*)&value.handle), "set arg");
+	if (argChanged(idx, &value.handle, sizeof(cl_mem)))
+		clTest(clSetKernelArg(handle, idx, sizeof(cl_mem), (void*)&value.handle), "set arg");
+	setArgDeps(idx, &value.deps, true);
 }
 
-template<>
-inline void CLKernel::setArg<CLBuffer<cl_int> >(int idx, const CLBuffer<cl_int>& value)
+template<class T>
+inline void CLKernel::setArg(int idx, const ReadOnly<T>& value)
 {
-	clTest(clSetKernelArg(handle, idx, sizeof(cl_mem), (void*)&value.handle), "set arg");
+	if (argChanged(idx, &value.buffer.handle, sizeof(cl_mem)))
+		clTest(clSetKernelArg(handle, idx, sizeof(cl_mem), (void*)&value.buffer.handle), "set arg");
+	setArgDeps(idx, &value.buffer.deps, false);
 }
 
-template<>
-inline void CLKernel::setArg<CLBuffer<cl_uint> >(int idx, const CLBuffer<cl_uint>& value)
+template<class T>
+inline void CLKernel::setArg(int idx, const CLConstBuffer<T>& value)
 {
-	clTest(clSetKernelArg(handle, idx, sizeof(cl_mem), (void*)&value.handle), "set arg");
+	if (argChanged(idx, &value.handle, sizeof(cl_mem)))
+		clTest(clSetKernelArg(handle, idx, sizeof(cl_mem), (void*)&value.handle), "set arg");
+	setArgDeps(idx, &value.deps, false);
 }
 
 template<typename T, typename... Args>
@@ -275,52 +627,55 @@ void CLKernel::call(size_t problem_size, size_t local, const T& value, const Arg
 	enqueue(problem_size, local);
 }
 
-template<class T>
-void CLVertexBuffer<T>::acquire() 
+template<typename G, typename... Args> 
+void CLCommandList::add(CLKernel& kernel, const G& problem_size, size_t local, const Args&... args)
 {
-	clTest(clEnqueueAcquireGLObjects(queue.handle, 1, &this->handle, 0, 0, 0), "aquire gl");
+	auto recorded = std::make_tuple(CLRecordedArg<G>(problem_size), CLRecordedArg<Args>(args)...);
+	commands.push_back([&kernel, local, recorded]() {
+		replay(kernel, local, recorded, std::index_sequence_for<Args...>());
+	});
 }
 
-template<class T>
-void CLVertexBuffer<T>::release() 
+template<typename Tuple, size_t... I>
+void CLCommandList::replay(CLKernel& kernel, size_t local, const Tuple& args, std::index_sequence<I...>)
 {
-	clTest(clEnqueueReleaseGLObjects(queue.handle, 1, &this->handle, 0, 0, 0), "release gl");
+	kernel.call(std::get<0>(args).get(), local, std::get<I + 1>(args).get()...);
 }
 
 template<class T>
-void CLVertexBuffer<T>::grow(int nsize)
+void CLCommandList::fill(CLBuffer<T>& buffer, const T& value)
 {
-	if (nsize <= size)
-		return;
-
-	vaLink.buffer.setSize(nsize * sizeof(T));
-	this->size = nsize;
-	clReleaseMemObject(this->handle);
-	cl_int err;
-	this->handle = clCreateFromGLBuffer(queue.context, CL_MEM_WRITE_ONLY, vaLink.buffer.handle, &err);
-	clTest(err, "create from gl");
+	commands.push_back([&buffer, value]() { buffer.fill(value); });
 }
 
 template<class T>
 CLConstBuffer<T>::CLConstBuffer(CLQueue& queue) : 
 	queue(queue) 
 {
-	cl_int err;
-	this->handle = clCreateBuffer(queue.context, CL_MEM_READ_WRITE, sizeof(T), nullptr, &err);
-	clTest(err, "create cl");
+	this->handle = queue.pool.alloc(queue.context, sizeof(T), CL_MEM_READ_WRITE, deps);
 }
 
 template<class T>
 void CLConstBuffer<T>::upload()
 {
-	clTest(clEnqueueWriteBuffer(queue.handle, handle, CL_TRUE, 0, sizeof(T),
-		&data, 0, nullptr, nullptr), "write const buffer");
+	// the previous write may still read staged
+	pending.wait();
+	staged = data;
+	CLCommand cmd(queue);
+	cmd.write(deps);
+	cmd.keepEvent();
+	cmd.prepare();
+	clTest(clEnqueueWriteBuffer(queue.handle, handle, CL_FALSE, 0, sizeof(T),
+		&staged, cmd.numWait(), cmd.wait(), cmd.event()), "write const buffer");
+	cmd.complete("write const buffer");
+	pending = cmd.takeEvent();
 }
 
 template<class T>
 CLConstBuffer<T>::~CLConstBuffer()
 {
-	clReleaseMemObject(this->handle);
+	pending.wait();
+	queue.pool.free(this->handle, deps);
 }
 
 
@@ -0,0 +1,141 @@
+#include "compute/glInterop.hpp"
+#include "render/opengl.hpp"
+#include <iostream>
+#if defined (_WIN32)
+	#define WINDOWS_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#elif !defined (__APPLE__)
+	#include <GL/glx.h>
+#endif
+
+using namespace std;
+
+static cl_device_id findCPUDevice(cl_platform_id platform) 
+{
+	// Enumerate devices
+	cl_device_id allDevices[16];
+	cl_uint num;
+	clTest(clGetDeviceIDs(platform, CL_DEVICE_TYPE_ALL, 16, allDevices, &num), "list devices");
+	for (int i = 0; i < num; i++)
+	{
+		size_t size;
+		cl_device_type type;
+		clGetDeviceInfo(allDevices[i], CL_DEVICE_TYPE, sizeof(type), &type, &size);
+		if (type == CL_DEVICE_TYPE_CPU)
+			return allDevices[i];
+	}
+	return nullptr;
+}
+
+static vector<cl_context_properties> renderContextProps(cl_platform_id platform) 
+{
+	vector<cl_context_properties> props;	
+#if defined (__APPLE__)
+	props.push_back(CL_CONTEXT_PROPERTY_USE_CGL_SHAREGROUP_APPLE);
+	props.push_back((intptr_t)CGLGetShareGroup(CGLGetCurrentContext()));	
+#elif defined (WIN32)
+	props.push_back(CL_GL_CONTEXT_KHR);
+	props.push_back((cl_context_properties)wglGetCurrentContext());
+	props.push_back(CL_WGL_HDC_KHR);
+	props.push_back((cl_context_properties)wglGetCurrentDC());
+#else
+	props.push_back(CL_GL_CONTEXT_KHR);
+	props.push_back((cl_context_properties)glXGetCurrentContext());
+	props.push_back(CL_GLX_DISPLAY_KHR);
+	props.push_back((cl_context_properties)glXGetCurrentDisplay());	
+#endif
+	props.push_back(CL_CONTEXT_PLATFORM);
+	props.push_back((cl_context_properties)platform);
+	props.push_back(0);
+	return props;
+}
+
+static cl_device_id findRenderDevice(cl_platform_id platform) 
+{
+	cl_device_id renderer = nullptr;
+	auto props = renderContextProps(platform);
+#if defined (__APPLE__)
+	cl_int err;
+	cl_context context = clCreateContext(&props[0], 0, nullptr, nullptr, nullptr, &err);
+	if (err != CL_SUCCESS)
+		return nullptr;
+	err = clGetGLContextInfoAPPLE(context, CGLGetCurrentContext(), CL_CGL_DEVICE_FOR_CURRENT_VIRTUAL_SCREEN_APPLE,
+		sizeof(renderer), &renderer, nullptr);
+	clReleaseContext(context);
+	if (err != CL_SUCCESS)
+		return nullptr;
+#else
+	// WGL and GLX both go through the KHR extension
+	auto fn = (clGetGLContextInfoKHR_fn)clGetExtensionFunctionAddressForPlatform(platform, "clGetGLContextInfoKHR");
+	if (!fn || fn(&props[0], CL_CURRENT_DEVICE_FOR_GL_CONTEXT_KHR, sizeof(renderer), &renderer, nullptr) != CL_SUCCESS)
+		return nullptr;
+#endif
+	if (!renderer)
+		return nullptr;
+	cl_device_type type;
+	size_t size;
+	clGetDeviceInfo(renderer, CL_DEVICE_TYPE, sizeof(type), &type, &size);
+	if (type != CL_DEVICE_TYPE_GPU)
+		return nullptr;
+	
+	return renderer;
+}
+
+void createQueues(CLQueue& cpu, CLQueue& gpu, cl_command_queue_properties properties)
+{
+	// Get platforms
+	cl_int err;
+	cl_uint numPlatforms;
+	cl_platform_id platform[16];
+	if (clGetPlatformIDs(16, &platform[0], &numPlatforms) != CL_SUCCESS || numPlatforms == 0)
+		fatalError("Can't obtain platforms");
+
+	// find GPU device
+	gpu.device = nullptr;
+	for (int i = 0; i < numPlatforms; i++)
+	{
+		gpu.device = findRenderDevice(platform[i]);
+		if (gpu.device) {
+			gpu.platform = platform[i];
+			break;
+		}
+		
+	}
+	if (!gpu.device)
+		fatalError("No OpenCL GPU device shares the current GL context");
+	gpu.sharesGL = true;
+
+	// find CPU device: try to share context first, then the rest
+	cpu.device = findCPUDevice(gpu.platform);
+	if (cpu.device) 
+	{
+		cpu.platform = gpu.platform;
+		cl_device_id devices[2] = { gpu.device, cpu.device };
+		gpu.context = clCreateContext(&renderContextProps(gpu.platform)[0], 2, devices, nullptr, nullptr, &err);
+		cpu.context = gpu.context;
+		cpu.sharesGL = true;
+		clTest(err, "create context");
+	}
+	else
+	{
+		for (int i = 0; i < numPlatforms && !cpu.device; i++)
+		{
+			cpu.device = findCPUDevice(platform[i]);
+			if (cpu.device)
+				cpu.platform = platform[i];
+		}
+		gpu.context = clCreateContext(&renderContextProps(gpu.platform)[0], 1, &gpu.device, nullptr, nullptr, &err);
+		clTest(err, "create context");
+		cl_context_properties props[] = { CL_CONTEXT_PLATFORM, (cl_context_properties)cpu.platform, 0 };
+		cpu.context = clCreateContext(props, 1, &cpu.device, nullptr, nullptr, &err);
+		clTest(err, "create context");
+	}
+	
+	// create queues
+	createQueueHandle(cpu, properties);
+	createQueueHandle(gpu, properties);
+
+	cpu.printInfo();
+	gpu.printInfo();
+}
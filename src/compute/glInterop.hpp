@@ -0,0 +1,82 @@
+// OpenCL contexts and buffers shared with OpenGL, for the display classes
+
+#ifndef COMPUTE_GLINTEROP_HPP
+#define COMPUTE_GLINTEROP_HPP
+
+#include "render/vertexArray.hpp"
+#include "compute/computeMain.hpp"
+
+// GPU queue on the device of the current GL context, CPU queue on a CPU device
+// of the same platform if there is one. Needs a current GL context.
+void createQueues(CLQueue& cpuQueue, CLQueue& gpuQueue, cl_command_queue_properties properties = 0);
+
+// Vertex buffer written by kernels, needs a queue with sharesGL
+template<class T>
+class CLVertexBuffer : public CLBuffer<T>
+{
+public:
+	CLVertexBuffer(CLQueue& queue, SingleVertexArray& va);
+
+	void acquire();
+	// GL may use the buffer once the event completed
+	CLEvent release();
+	void grow(int nsize);
+
+	SingleVertexArray& vaLink;
+};
+
+// ------------------------------------
+// IMPLEMENTATION
+// ------------------------------------
+
+template<class T>
+CLVertexBuffer<T>::CLVertexBuffer(CLQueue& queue, SingleVertexArray& va) :
+	CLBuffer<T>(queue), vaLink(va)
+{
+	cl_int err;
+	if (!queue.sharesGL)
+		fatalError("Vertex buffer needs a queue sharing the GL context");
+	this->type = BufferType::Gpu;
+	this->size = va.buffer.size / sizeof(T);
+	this->reserve = va.buffer.size / sizeof(T);
+	this->handle = clCreateFromGLBuffer(queue.context, CL_MEM_WRITE_ONLY, va.buffer.handle, &err);
+	clTest(err, "create cl/gl buffer");
+}
+
+template<class T>
+void CLVertexBuffer<T>::acquire() 
+{
+	CLCommand cmd(this->queue);
+	cmd.write(this->deps);
+	cmd.prepare();
+	clTest(clEnqueueAcquireGLObjects(this->queue.handle, 1, &this->handle, cmd.numWait(), cmd.wait(), cmd.event()), "aquire gl");
+	cmd.complete("acquire gl");
+}
+
+template<class T>
+CLEvent CLVertexBuffer<T>::release() 
+{
+	CLCommand cmd(this->queue);
+	cmd.write(this->deps);
+	cmd.keepEvent();
+	cmd.prepare();
+	clTest(clEnqueueReleaseGLObjects(this->queue.handle, 1, &this->handle, cmd.numWait(), cmd.wait(), cmd.event()), "release gl");
+	cmd.complete("release gl");
+	return cmd.takeEvent();
+}
+
+template<class T>
+void CLVertexBuffer<T>::grow(int nsize)
+{
+	if (nsize <= this->size)
+		return;
+
+	vaLink.buffer.setSize(nsize * sizeof(T));
+	this->size = nsize;
+	clReleaseMemObject(this->handle);
+	cl_int err;
+	this->handle = clCreateFromGLBuffer(this->queue.context, CL_MEM_WRITE_ONLY, vaLink.buffer.handle, &err);
+	clTest(err, "create from gl");
+}
+
+#endif
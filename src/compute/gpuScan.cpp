@@ -0,0 +1,43 @@
+#include "compute/gpuScan.hpp"
+
+using namespace std;
+
+PrefixScan::PrefixScan(CLQueue& queue) :
+	queue(queue),
+	scanBlocks(queue, "scan.cl", "scanBlocks"),
+	addBlockOffsets(queue, "scan.cl", "addBlockOffsets")
+{
+}
+
+void PrefixScan::exclusive(CLBuffer<cl_uint>& in, CLBuffer<cl_uint>& out, int n)
+{
+	scan(in, out, n, false, 0);
+}
+
+void PrefixScan::inclusive(CLBuffer<cl_uint>& in, CLBuffer<cl_uint>& out, int n)
+{
+	scan(in, out, n, true, 0);
+}
+
+void PrefixScan::scan(CLBuffer<cl_uint>& in, CLBuffer<cl_uint>& out, int n, bool inclusive, int level)
+{
+	if (n <= 0)
+		return;
+	if (n > (int)in.size || n > (int)out.size)
+		fatalError("Scan size > array size");
+
+	int blocks = (n + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	if ((int)blockSums.size() <= level)
+		blockSums.emplace_back(new CLBuffer<cl_uint>(queue, blocks, BufferType::Gpu));
+	auto& sums = *blockSums[level];
+	if ((int)sums.size < blocks)
+		sums.resize(blocks);
+
+	scanBlocks.call(blocks * WG_SIZE, WG_SIZE, in, out, sums, (cl_uint)n, (cl_uint)inclusive);
+	if (blocks == 1)
+		return;
+
+	// offsets of the blocks, then add them back
+	scan(sums, sums, blocks, false, level + 1);
+	addBlockOffsets.call(n, WG_SIZE, out, readOnly(sums), (cl_uint)n);
+}
@@ -0,0 +1,30 @@
+// OpenCL prefix scan
+
+#ifndef COMPUTE_GPUSCAN_HPP
+#define COMPUTE_GPUSCAN_HPP
+
+#include <memory>
+#include "compute/computeMain.hpp"
+
+class PrefixScan
+{
+public:
+	PrefixScan(CLQueue& queue);
+
+	// out[i] = sum of in[0..i), any n; in and out may be the same buffer
+	void exclusive(CLBuffer<cl_uint>& in, CLBuffer<cl_uint>& out, int n);
+	// out[i] = sum of in[0..i]
+	void inclusive(CLBuffer<cl_uint>& in, CLBuffer<cl_uint>& out, int n);
+
+protected:
+	void scan(CLBuffer<cl_uint>& in, CLBuffer<cl_uint>& out, int n, bool inclusive, int level);
+
+	enum { WG_SIZE = 256, BLOCK_SIZE = 1024 }; // see scan.cl
+
+	CLQueue& queue;
+	CLKernel scanBlocks;
+	CLKernel addBlockOffsets;
+	std::vector<std::unique_ptr<CLBuffer<cl_uint> > > blockSums; // per recursion level
+};
+
+#endif
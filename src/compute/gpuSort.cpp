@@ -1,4 +1,8 @@
 #include "compute/gpuSort.hpp"
+#include "compute/tuneCache.hpp"
+#include <chrono>
+#include <random>
+#include <algorithm>
 
 using namespace std;
 
@@ -7,8 +11,13 @@ BitonicSort::BitonicSort(CLQueue& queue) :
 	kernelSortLocal(queue, "BitonicSort_b.cl", "bitonicSortLocal"),
 	kernelSortLocal1(queue, "BitonicSort_b.cl", "bitonicSortLocal1"),
 	kernelMergeLocal(queue, "BitonicSort_b.cl", "bitonicMergeLocal"),
-	kernelMergeGlobal(queue, "BitonicSort_b.cl", "bitonicMergeGlobal")
+	kernelMergeGlobal(queue, "BitonicSort_b.cl", "bitonicMergeGlobal"),
+	kernelSplit(queue, "primitives.cl", "splitPairs"),
+	kernelJoin(queue, "primitives.cl", "joinPairs"),
+	keys(queue), values(queue), sortedKeys(queue), sortedValues(queue)
 {
+	keys.type = values.type = BufferType::Gpu;
+	sortedKeys.type = sortedValues.type = BufferType::Gpu;
 }
 
 inline bool isPowerOf2(int x)
@@ -30,13 +39,11 @@ void BitonicSort::sort(const CLBuffer<cl_uint>& keySrc, CLBuffer<cl_uint>& keyDe
 
 	if (N == LOCAL_SIZE_LIMIT)
 	{
-		kernelSortLocal.setArgs(keyDest.handle, dataDest.handle, keySrc.handle, dataSrc.handle, N, dir);		
-		kernelSortLocal.enqueue(N / 2, LOCAL_SIZE_LIMIT / 2);
+		kernelSortLocal.call(N / 2, LOCAL_SIZE_LIMIT / 2, keyDest, dataDest, keySrc, dataSrc, N, dir);
 	}
 	else
 	{
-		kernelSortLocal1.setArgs(keyDest.handle, dataDest.handle, keySrc.handle, dataSrc.handle);
-		kernelSortLocal1.enqueue(N / 2, LOCAL_SIZE_LIMIT / 2);
+		kernelSortLocal1.call(N / 2, LOCAL_SIZE_LIMIT / 2, keyDest, dataDest, keySrc, dataSrc);
 
 		for (unsigned int size = 2 * LOCAL_SIZE_LIMIT; size <= N; size <<= 1)
 		{
@@ -44,19 +51,37 @@ void BitonicSort::sort(const CLBuffer<cl_uint>& keySrc, CLBuffer<cl_uint>& keyDe
 			{
 				if (stride >= LOCAL_SIZE_LIMIT)
 				{
-					kernelMergeGlobal.setArgs(keyDest.handle, dataDest.handle, keyDest.handle, dataDest.handle, N, size, stride, dir);
-					kernelMergeGlobal.enqueue(N / 2, LOCAL_SIZE_LIMIT / 4);					
+					kernelMergeGlobal.call(N / 2, LOCAL_SIZE_LIMIT / 4, keyDest, dataDest, keyDest, dataDest, N, size, stride, dir);
 				}
 				else
 				{
-					kernelMergeLocal.setArgs(keyDest.handle, dataDest.handle, keyDest.handle, dataDest.handle, N, stride, size, dir);
-					kernelMergeLocal.enqueue(N / 2, LOCAL_SIZE_LIMIT / 2);
+					kernelMergeLocal.call(N / 2, LOCAL_SIZE_LIMIT / 2, keyDest, dataDest, keyDest, dataDest, N, stride, size, dir);
 				}
 			}
 		}
 	}
 }
 
+void BitonicSort::sort(CLBuffer<cl_uint2>& data, int N, int sortBits)
+{
+	if (N > data.size)
+		fatalError("Sort size > array size");
+	if (N <= 1)
+		return;
+	int padded = LOCAL_SIZE_LIMIT;
+	while (padded < N)
+		padded *= 2;
+	keys.resize(padded);
+	values.resize(padded);
+	sortedKeys.resize(padded);
+	sortedValues.resize(padded);
+
+	// the padding keys are maximal and end up behind the real ones; unlike the
+	// radix sort this compares all key bits and is not stable
+	kernelSplit.call(padded, 256, readOnly(data), keys, values, (cl_uint)N, (cl_uint)padded);
+	sort(keys, sortedKeys, values, sortedValues, padded);
+	kernelJoin.call(N, 256, readOnly(sortedKeys), readOnly(sortedValues), data, (cl_uint)N);
+}
 
 RadixSort::RadixSort(CLQueue& queue) :
 	queue(queue),
@@ -67,39 +92,83 @@ RadixSort::RadixSort(CLQueue& queue) :
 {
 	work.type = BufferType::Gpu;
 	workHisto.type = BufferType::Gpu;
+
+	// stored autotune result, or a few work-groups per compute unit
+	if (!TuneCache::get().lookup(queue, "radixSort.numWGs", numWGs))
+	{
+		cl_uint units = 1;
+		clGetDeviceInfo(queue.device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(units), &units, nullptr);
+		numWGs = min((int)units * WGS_PER_CU, (int)MAX_WGS);
+	}
+}
+
+void RadixSort::autotune(int n)
+{
+	CLBuffer<cl_uint2> keys(queue, paddedSize(n), BufferType::Both);
+	mt19937 rng(7);
+	for (auto& k : keys.buffer)
+		k = { { (cl_uint)rng(), 0 } };
+
+	int best = numWGs;
+	double bestTime = 1e30;
+	for (int wgs = 8; wgs <= MAX_WGS; wgs += 8)
+	{
+		numWGs = wgs;
+		double time = 1e30;
+		for (int rep = 0; rep < 3; rep++)
+		{
+			keys.upload();
+			clFinish(queue.handle);
+			auto start = chrono::high_resolution_clock::now();
+			sort(keys, n);
+			clFinish(queue.handle);
+			time = min(time, chrono::duration<double>(chrono::high_resolution_clock::now() - start).count());
+		}
+		if (time < bestTime)
+		{
+			bestTime = time;
+			best = wgs;
+		}
+	}
+	numWGs = best;
+	TuneCache::get().store(queue, "radixSort.numWGs", numWGs);
 }
 
 
-void RadixSort::sort(CLBuffer<cl_uint2>& data, int n)
+void RadixSort::sort(CLBuffer<cl_uint2>& data, int n, int sortBits)
 {
-	if (n % DATA_ALIGNMENT != 0)
-		fatalError("Data size needs to be aligned");
-	if (n > data.size)
-		fatalError("Search size > array size");
+	// Pad to whole blocks with maximal keys. They sort behind every real key,
+	// and behind equal ones as the sort is stable.
+	int padded = paddedSize(n);
+	if (padded > data.size)
+		fatalError("Sort buffer needs room for the padded size");
+	if (padded != n)
+		data.fill({ { 0xFFFFFFFFU, 0xFFFFFFFFU } }, n, padded - n);
+	n = padded;
 	
 	work.resize(n);
 	CLBuffer<cl_uint2>* src = &data;
 	CLBuffer<cl_uint2>* dst = &work;
 	
-	int minCap = NUM_BUCKET * NUM_WGS;
+	int minCap = NUM_BUCKET * numWGs;
 	workHisto.resize(minCap);
 	
 	//	ADLASSERT( ELEMENTS_PER_WORK_ITEM == 4 );
-	const int sortBits = 32;
 	assert(BITS_PER_PASS == 4);
 	assert(WG_SIZE == 64);
-	assert((sortBits & 0x3) == 0);
+	if (sortBits <= 0 || sortBits > 32)
+		fatalError("Invalid sort bit count");
 	
-	int nWGs = NUM_WGS;
+	int nWGs = numWGs;
 	ConstData cdata;
 	{
 		int blockSize = ELEMENTS_PER_WORK_ITEM*WG_SIZE;//set at 256
 		int nBlocks = (n + blockSize - 1) / (blockSize);
 		cdata.m_n = n;
-		cdata.m_nWGs = NUM_WGS;
+		cdata.m_nWGs = numWGs;
 		cdata.m_startBit = 0;
 		cdata.m_nBlocksPerWG = (nBlocks + cdata.m_nWGs - 1) / cdata.m_nWGs;
-		if (nBlocks < NUM_WGS)
+		if (nBlocks < numWGs)
 		{
 			cdata.m_nBlocksPerWG = 1;
 			nWGs = nBlocks;
@@ -110,7 +179,7 @@ void RadixSort::sort(CLBuffer<cl_uint2>& data, int n)
 	for (int ib = 0; ib < sortBits; ib += 4)
 	{
 		cdata.m_startBit = ib;
-		streamCountSortDataKernel.call(NUM_WGS*WG_SIZE, WG_SIZE, *src, workHisto, cdata);
+		streamCountSortDataKernel.call(numWGs*WG_SIZE, WG_SIZE, *src, workHisto, cdata);
 
 #ifdef __APPLE__
 		fatalError("fast prefix scan not supported on OSX");
@@ -124,8 +193,7 @@ void RadixSort::sort(CLBuffer<cl_uint2>& data, int n)
 		count++;
 	}
 
+	// odd number of passes, the result is in work
 	if (count & 1)
-	{
-		assert(0); //need to copy from work to data
-	}
+		data.copyFrom(work, n);
 }
@@ -1,32 +1,53 @@
-// OpenCL Bitonic sort
+// OpenCL bitonic and radix sort
 
 #ifndef COMPUTE_SORT_HPP
 #define COMPUTE_SORT_HPP
 
 #include "compute/computeMain.hpp"
+#include "compute/sorter.hpp"
 
-class BitonicSort
+class BitonicSort : public Sorter
 {
 public:
 	BitonicSort(CLQueue& queue);
 
+	// separate key and value arrays, N a power of two >= 512
 	void sort(const CLBuffer<cl_uint>& keySrc, CLBuffer<cl_uint>& keyDest,
 			  const CLBuffer<cl_uint>& dataSrc, CLBuffer<cl_uint>& dataDest, int N);
 
+	// any N: split into key and value arrays padded to a power of two, sort, join
+	void sort(CLBuffer<cl_uint2>& data, int N, int sortBits = 32) override;
+	const char* name() const override { return "bitonic"; }
+
 protected:
 	CLQueue& queue;
 	CLKernel kernelSortLocal;
 	CLKernel kernelSortLocal1;
 	CLKernel kernelMergeLocal;
 	CLKernel kernelMergeGlobal;
+	CLKernel kernelSplit;
+	CLKernel kernelJoin;
+
+	CLBuffer<cl_uint> keys, values, sortedKeys, sortedValues;
 };
 
-class RadixSort
+class RadixSort : public Sorter
 {
 public:
 	RadixSort(CLQueue& queue);
 
-	void sort(CLBuffer<cl_uint2>& data, int N);
+	// Sorts (key, value) pairs by the low sortBits bits of the key. Any N
+	// works; data needs room for paddedSize(N) elements, the tail is overwritten.
+	void sort(CLBuffer<cl_uint2>& data, int N, int sortBits = 32) override;
+	int bufferSize(int N) const override { return paddedSize(N); }
+	const char* name() const override { return "radix"; }
+
+	static int paddedSize(int n) { return (n + DATA_ALIGNMENT - 1) / DATA_ALIGNMENT * DATA_ALIGNMENT; }
+
+	// time the candidate work-group counts on n random keys, keep and store the fastest
+	void autotune(int n);
+
+	int numWGs; // work-groups of the count and scatter kernels
 
 protected:
 	struct ConstData
@@ -45,10 +66,9 @@ protected:
 		ELEMENTS_PER_WORK_ITEM = (BLOCK_SIZE / WG_SIZE),
 		BITS_PER_PASS = 4,
 		NUM_BUCKET = (1 << BITS_PER_PASS),
-		//	if you change this, change nPerWI in kernel as well
-		NUM_WGS = 20 * 6,	//	cypress
-		//			NUM_WGS = 24*6,	//	cayman
-		//			NUM_WGS = 32*4,	//	nv
+		//	prefix scan handles NUM_BUCKET * numWGs <= 128 * nPerWI, see kernel
+		MAX_WGS = 128,
+		WGS_PER_CU = 6,
 	};
 
 	CLQueue& queue;
@@ -0,0 +1,107 @@
+#include "compute/primitives.hpp"
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+Primitives::Primitives(CLQueue& queue) :
+	queue(queue),
+	scan(queue),
+	clReduceFloat(queue, "primitives.cl", "reduceFloat"),
+	clReduceUint(queue, "primitives.cl", "reduceUint"),
+	clReduceNorm(queue, "primitives.cl", "reduceNorm"),
+	clCompact(queue, "primitives.cl", "compactIndices"),
+	clHistogramLocal(queue, "primitives.cl", "histogramLocal"),
+	clHistogramGlobal(queue, "primitives.cl", "histogramGlobal"),
+	partialFloat(queue, REDUCE_WG, BufferType::Gpu),
+	resultFloat(queue, 1, BufferType::Both),
+	partialUint(queue, REDUCE_WG, BufferType::Gpu),
+	resultUint(queue, 1, BufferType::Both),
+	flagScan(queue, 1, BufferType::Gpu)
+{
+	// enough work-groups to fill the device, few enough for a single second pass
+	cl_uint units = 1;
+	clGetDeviceInfo(queue.device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(units), &units, nullptr);
+	maxGroups = min((int)units * 8, (int)REDUCE_WG);
+
+	cl_ulong localMem = 0;
+	clTest(clGetDeviceInfo(queue.device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(localMem), &localMem, nullptr),
+		"local memory size");
+	maxLocalBins = (int)(localMem / 2 / sizeof(cl_uint));
+}
+
+int Primitives::reduceGroups(int n) const
+{
+	return max(1, min(maxGroups, (n + REDUCE_WG - 1) / REDUCE_WG));
+}
+
+float Primitives::reduce(CLBuffer<cl_float>& in, int n, ReduceOp op)
+{
+	if (n > (int)in.size)
+		fatalError("Reduce size > array size");
+	const float identity = (op == ReduceOp::Sum) ? 0.0f :
+		(op == ReduceOp::Min) ? numeric_limits<float>::infinity() : -numeric_limits<float>::infinity();
+	const int groups = reduceGroups(n);
+	clReduceFloat.call(groups * REDUCE_WG, REDUCE_WG, readOnly(in), partialFloat, (cl_uint)n, (cl_uint)op, identity);
+	clReduceFloat.call(REDUCE_WG, REDUCE_WG, readOnly(partialFloat), resultFloat, (cl_uint)groups, (cl_uint)op, identity);
+	resultFloat.download();
+	return resultFloat.buffer[0];
+}
+
+cl_uint Primitives::reduce(CLBuffer<cl_uint>& in, int n, ReduceOp op)
+{
+	if (n > (int)in.size)
+		fatalError("Reduce size > array size");
+	const cl_uint identity = (op == ReduceOp::Min) ? 0xFFFFFFFFU : 0;
+	const int groups = reduceGroups(n);
+	clReduceUint.call(groups * REDUCE_WG, REDUCE_WG, readOnly(in), partialUint, (cl_uint)n, (cl_uint)op, identity);
+	clReduceUint.call(REDUCE_WG, REDUCE_WG, readOnly(partialUint), resultUint, (cl_uint)groups, (cl_uint)op, identity);
+	resultUint.download();
+	return resultUint.buffer[0];
+}
+
+float Primitives::maxNorm(CLBuffer<cl_float2>& in, int n)
+{
+	if (n > (int)in.size)
+		fatalError("Reduce size > array size");
+	const cl_uint op = (cl_uint)ReduceOp::Max;
+	const int groups = reduceGroups(n);
+	clReduceNorm.call(groups * REDUCE_WG, REDUCE_WG, readOnly(in), partialFloat, (cl_uint)n, op, 0.0f);
+	clReduceFloat.call(REDUCE_WG, REDUCE_WG, readOnly(partialFloat), resultFloat, (cl_uint)groups, op, 0.0f);
+	resultFloat.download();
+	return resultFloat.buffer[0];
+}
+
+int Primitives::compact(CLBuffer<cl_uint>& flags, int n, CLBuffer<cl_uint>& indices)
+{
+	if (n <= 0)
+		return 0;
+	if (n > (int)flags.size || n > (int)indices.size)
+		fatalError("Compact size > array size");
+	if ((int)flagScan.size < n)
+		flagScan.resize(n);
+
+	scan.inclusive(flags, flagScan, n);
+	clCompact.call(n, REDUCE_WG, readOnly(flags), readOnly(flagScan), indices, resultUint, (cl_uint)n);
+	resultUint.download();
+	return (int)resultUint.buffer[0];
+}
+
+void Primitives::histogram(CLBuffer<cl_uint>& keys, int n, CLBuffer<cl_uint>& bins, int numBins)
+{
+	if (n > (int)keys.size || numBins > (int)bins.size)
+		fatalError("Histogram size > array size");
+	bins.fill(0, 0, numBins);
+	if (n <= 0)
+		return;
+
+	if (numBins <= maxLocalBins)
+	{
+		// at least 16 keys per work-item, so merging the bins stays cheap
+		const int groups = max(1, min(maxGroups, (n + HIST_WG * 16 - 1) / (HIST_WG * 16)));
+		clHistogramLocal.call(groups * HIST_WG, HIST_WG, readOnly(keys), bins, 
+			LocalBlock(numBins * sizeof(cl_uint)), (cl_uint)n, (cl_uint)numBins);
+	}
+	else
+		clHistogramGlobal.call(n, HIST_WG, readOnly(keys), bins, (cl_uint)n, (cl_uint)numBins);
+}
@@ -0,0 +1,56 @@
+// Reusable OpenCL primitives: scan, reduction, compaction, histogram
+
+#ifndef COMPUTE_PRIMITIVES_HPP
+#define COMPUTE_PRIMITIVES_HPP
+
+#include "compute/computeMain.hpp"
+#include "compute/gpuScan.hpp"
+
+enum class ReduceOp { Sum = 0, Min = 1, Max = 2 }; // REDUCE_* in primitives.cl
+
+// All of them take an element count and work for any size up to the buffer size.
+// Results that end up on the host are blocking reads.
+class Primitives
+{
+public:
+	Primitives(CLQueue& queue);
+
+	// out[i] = sum of in[0..i) or in[0..i]; in and out may be the same buffer
+	void exclusiveScan(CLBuffer<cl_uint>& in, CLBuffer<cl_uint>& out, int n) { scan.exclusive(in, out, n); }
+	void inclusiveScan(CLBuffer<cl_uint>& in, CLBuffer<cl_uint>& out, int n) { scan.inclusive(in, out, n); }
+
+	// identity of the operation for n == 0; uint sums wrap around
+	float reduce(CLBuffer<cl_float>& in, int n, ReduceOp op);
+	cl_uint reduce(CLBuffer<cl_uint>& in, int n, ReduceOp op);
+	// largest vector length, e.g. max velocity for a CFL time step
+	float maxNorm(CLBuffer<cl_float2>& in, int n);
+
+	// indices of the set entries of flags (0 or 1) in ascending order, returns their count
+	int compact(CLBuffer<cl_uint>& flags, int n, CLBuffer<cl_uint>& indices);
+
+	// bins[k] = number of keys equal to k, keys >= numBins are skipped
+	void histogram(CLBuffer<cl_uint>& keys, int n, CLBuffer<cl_uint>& bins, int numBins);
+
+protected:
+	int reduceGroups(int n) const;
+
+	enum { REDUCE_WG = 256, HIST_WG = 256 };
+
+	CLQueue& queue;
+	PrefixScan scan;
+	CLKernel clReduceFloat;
+	CLKernel clReduceUint;
+	CLKernel clReduceNorm;
+	CLKernel clCompact;
+	CLKernel clHistogramLocal;
+	CLKernel clHistogramGlobal;
+	int maxGroups;
+	int maxLocalBins;
+
+	// per-group partials, final values and the scratch scan
+	CLBuffer<cl_float> partialFloat, resultFloat;
+	CLBuffer<cl_uint> partialUint, resultUint;
+	CLBuffer<cl_uint> flagScan;
+};
+
+#endif
@@ -0,0 +1,126 @@
+#include "compute/profiler.hpp"
+#include "compute/computeMain.hpp"
+#include <iomanip>
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+void CLProfiler::Stats::add(double ms)
+{
+	if (histogram.empty())
+		histogram.resize(BINS_PER_DECADE * DECADES);
+	min = (count == 0) ? ms : std::min(min, ms);
+	max = std::max(max, ms);
+	total += ms;
+	count++;
+
+	// bin 0 starts at 1us
+	int bin = (int)floor(log10(std::max(ms * 1000.0, 1.0)) * BINS_PER_DECADE);
+	bin = std::min(bin, (int)histogram.size() - 1);
+	histogram[bin]++;
+}
+
+double CLProfiler::Stats::percentile(double p) const
+{
+	if (count == 0)
+		return 0;
+	size_t target = (size_t)ceil(p * count);
+	size_t sum = 0;
+	for (size_t i = 0; i < histogram.size(); i++)
+	{
+		sum += histogram[i];
+		if (sum >= target)
+		{
+			// upper edge of the bin, in ms
+			double ms = pow(10.0, (double)(i + 1) / BINS_PER_DECADE) / 1000.0;
+			return std::min(ms, max);
+		}
+	}
+	return max;
+}
+
+void CLProfiler::attach(CLQueue& queue)
+{
+	cl_command_queue_properties props;
+	clTest(clGetCommandQueueInfo(queue.handle, CL_QUEUE_PROPERTIES, sizeof(props), &props, nullptr), "queue info");
+	if (!(props & CL_QUEUE_PROFILING_ENABLE))
+		fatalError("Profiler needs a queue with CL_QUEUE_PROFILING_ENABLE");
+	queue.profiler = this;
+}
+
+void CLProfiler::record(const string& name, cl_event event)
+{
+	pending.push_back({ name, event });
+
+	// don't hold on to too many events if frames are never closed
+	if (pending.size() > 4096)
+		resolve();
+}
+
+void CLProfiler::resolve()
+{
+	for (auto& p : pending)
+	{
+		cl_ulong start, end;
+		clTest(clWaitForEvents(1, &p.event), "wait for event");
+		clTest(clGetEventProfilingInfo(p.event, CL_PROFILING_COMMAND_START, sizeof(start), &start, nullptr), "profiling start");
+		clTest(clGetEventProfilingInfo(p.event, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr), "profiling end");
+		clReleaseEvent(p.event);
+
+		double ms = (end - start) * 1e-6;
+		stats[p.name].add(ms);
+		auto& f = frame[p.name];
+		f.first++;
+		f.second += ms;
+	}
+	pending.clear();
+}
+
+void CLProfiler::endFrame()
+{
+	resolve();
+	if (frameLog)
+	{
+		for (auto& it : frame)
+			*frameLog << frameCount << "," << it.first << "," << it.second.first << "," << it.second.second << "\n";
+	}
+	lastFrame.swap(frame);
+	frame.clear();
+	frameCount++;
+}
+
+void CLProfiler::printSummary(ostream& out)
+{
+	resolve();
+	double total = 0;
+	for (auto& it : stats)
+		total += it.second.total;
+
+	out << "Kernel profile over " << frameCount << " frames:" << endl;
+	out << "  " << setw(32) << left << "kernel" << right << setw(10) << "count" << setw(11) << "min ms"
+		<< setw(11) << "mean ms" << setw(11) << "p99 ms" << setw(13) << "ms/frame" << setw(8) << "%" << endl;
+	for (auto& it : stats)
+	{
+		const Stats& s = it.second;
+		out << "  " << setw(32) << left << it.first << right << setw(10) << s.count << fixed << setprecision(4)
+			<< setw(11) << s.min << setw(11) << s.total / s.count << setw(11) << s.percentile(0.99)
+			<< setw(13) << s.total / max(frameCount, 1) << setprecision(1) << setw(8) << 100.0 * s.total / total << endl;
+	}
+	out.unsetf(ios::fixed);
+}
+
+void CLProfiler::printFrame(ostream& out)
+{
+	double total = 0;
+	for (auto& it : lastFrame)
+		total += it.second.second;
+
+	out << "Frame " << frameCount - 1 << " breakdown, " << total << " ms device time:" << endl;
+	for (auto& it : lastFrame)
+	{
+		out << "  " << setw(32) << left << it.first << right << setw(6) << it.second.first
+			<< fixed << setprecision(4) << setw(11) << it.second.second << " ms" << endl;
+	}
+	out.unsetf(ios::fixed);
+}
@@ -0,0 +1,58 @@
+// Per-kernel OpenCL event profiling
+
+#ifndef COMPUTE_PROFILER_HPP
+#define COMPUTE_PROFILER_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <iostream>
+#include "compute/opencl.hpp"
+
+class CLQueue;
+
+class CLProfiler
+{
+public:
+	// queue needs to be created with CL_QUEUE_PROFILING_ENABLE
+	void attach(CLQueue& queue);
+
+	// takes ownership of the event
+	void record(const std::string& name, cl_event event);
+
+	// resolve all pending events and close the current frame
+	void endFrame();
+
+	void printSummary(std::ostream& out);
+	void printFrame(std::ostream& out);
+
+	// if set, every frame's breakdown is written here as 'frame,kernel,count,ms'
+	std::ostream* frameLog = nullptr;
+
+protected:
+	struct Stats
+	{
+		void add(double ms);
+		double percentile(double p) const;
+
+		// log-scale histogram, sufficient for percentiles without keeping all samples
+		enum { BINS_PER_DECADE = 100, DECADES = 8 }; // 1us .. 100s
+		std::vector<unsigned> histogram;
+		size_t count = 0;
+		double total = 0, min = 0, max = 0;
+	};
+	struct Pending
+	{
+		std::string name;
+		cl_event event;
+	};
+
+	void resolve();
+
+	std::vector<Pending> pending;
+	std::map<std::string, Stats> stats;
+	std::map<std::string, std::pair<int,double> > frame, lastFrame;
+	int frameCount = 0;
+};
+
+#endif
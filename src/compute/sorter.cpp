@@ -0,0 +1,49 @@
+#include "compute/sorter.hpp"
+#include <algorithm>
+
+using namespace std;
+
+// 8 bits per pass. Each chunk counts its digits, a serial scan over
+// (digit, chunk) gives every chunk its scatter offsets, and the chunks
+// scatter in parallel. Passes ping-pong between keys and the scratch
+// range, elements from num on are never touched.
+void HostRadixSort::sort(vector<cl_uint2>& keys, int num, int sortBits)
+{
+	if (num > (int)keys.size())
+		fatalError("Sort size > array size");
+	const int chunks = max(1, min(pool.size() * 4, num / 4096));
+	histogram.resize(chunks * 256);
+	if ((int)keysTmp.size() < num)
+		keysTmp.resize(num);
+	cl_uint2* src = keys.data();
+	cl_uint2* dst = keysTmp.data();
+
+	auto chunkBegin = [&](int c) { return (int)((long long)num * c / chunks); };
+	for (int shift = 0; shift < sortBits; shift += 8)
+	{
+		pool.run(chunks, [&](int c) {
+			cl_uint* hist = &histogram[c * 256];
+			fill(hist, hist + 256, 0);
+			for (int i = chunkBegin(c), end = chunkBegin(c + 1); i < end; i++)
+				hist[(src[i].x >> shift) & 0xFF]++;
+		});
+
+		cl_uint sum = 0;
+		for (int digit = 0; digit < 256; digit++)
+		for (int c = 0; c < chunks; c++)
+		{
+			cl_uint count = histogram[c * 256 + digit];
+			histogram[c * 256 + digit] = sum;
+			sum += count;
+		}
+
+		pool.run(chunks, [&](int c) {
+			cl_uint* offset = &histogram[c * 256];
+			for (int i = chunkBegin(c), end = chunkBegin(c + 1); i < end; i++)
+				dst[offset[(src[i].x >> shift) & 0xFF]++] = src[i];
+		});
+		swap(src, dst);
+	}
+	if (src != keys.data())
+		copy(src, src + num, keys.data());
+}
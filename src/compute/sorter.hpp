@@ -0,0 +1,43 @@
+// Common interface of the key/value sorts, and the host-side radix sort
+
+#ifndef COMPUTE_SORTER_HPP
+#define COMPUTE_SORTER_HPP
+
+#include <vector>
+#include "compute/computeMain.hpp"
+#include "tools/threadPool.hpp"
+
+// Sorts (key, value) pairs by key, in place
+class Sorter
+{
+public:
+	virtual ~Sorter() {}
+
+	// sorts the first N pairs by the low sortBits bits of the key
+	virtual void sort(CLBuffer<cl_uint2>& data, int N, int sortBits = 32) = 0;
+	// elements data has to hold for N pairs, the tail may be overwritten
+	virtual int bufferSize(int N) const { return N; }
+	virtual const char* name() const = 0;
+	// sorts the host side of data instead of the device copy
+	virtual bool onHost() const { return false; }
+};
+
+// Parallel LSD radix sort with 8-bit digits, stable. Works on the host side
+// of the buffer; the device copy is left untouched.
+class HostRadixSort : public Sorter
+{
+public:
+	HostRadixSort(ThreadPool& pool) : pool(pool) {}
+
+	void sort(CLBuffer<cl_uint2>& data, int N, int sortBits = 32) override { sort(data.buffer, N, sortBits); }
+	void sort(std::vector<cl_uint2>& keys, int N, int sortBits = 32);
+	const char* name() const override { return "host radix"; }
+	bool onHost() const override { return true; }
+
+protected:
+	ThreadPool& pool;
+	std::vector<cl_uint2> keysTmp; // ping-pong scratch for the first N keys
+	std::vector<cl_uint> histogram; // digit offsets per chunk
+};
+
+#endif
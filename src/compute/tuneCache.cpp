@@ -0,0 +1,62 @@
+#include "compute/tuneCache.hpp"
+#include "compute/computeMain.hpp"
+#include <fstream>
+#include <algorithm>
+
+using namespace std;
+
+TuneCache& TuneCache::get()
+{
+	static TuneCache instance;
+	return instance;
+}
+
+string TuneCache::deviceKey(CLQueue& queue)
+{
+	char name[256] = { 0 }, driver[256] = { 0 };
+	clGetDeviceInfo(queue.device, CL_DEVICE_NAME, sizeof(name) - 1, name, nullptr);
+	clGetDeviceInfo(queue.device, CL_DRIVER_VERSION, sizeof(driver) - 1, driver, nullptr);
+	string key = string(name) + "/" + driver;
+	replace(key.begin(), key.end(), ' ', '_');
+	return key;
+}
+
+void TuneCache::load()
+{
+	if (loaded)
+		return;
+	loaded = true;
+	ifstream file(filename);
+	string key;
+	int value;
+	while (file >> key >> value)
+		values[key] = value;
+}
+
+void TuneCache::save()
+{
+	ofstream file(filename);
+	if (!file.is_open())
+		fatalError("Can't write tune cache " + filename);
+	for (auto& it : values)
+		file << it.first << " " << it.second << endl;
+}
+
+bool TuneCache::lookup(CLQueue& queue, const string& key, int& value)
+{
+	lock_guard<std::mutex> lock(mutex);
+	load();
+	auto it = values.find(deviceKey(queue) + ":" + key);
+	if (it == values.end())
+		return false;
+	value = it->second;
+	return true;
+}
+
+void TuneCache::store(CLQueue& queue, const string& key, int value)
+{
+	lock_guard<std::mutex> lock(mutex);
+	load();
+	values[deviceKey(queue) + ":" + key] = value;
+	save();
+}
@@ -0,0 +1,36 @@
+// Persistent store for autotuned kernel parameters
+
+#ifndef COMPUTE_TUNECACHE_HPP
+#define COMPUTE_TUNECACHE_HPP
+
+#include <string>
+#include <map>
+#include <mutex>
+
+class CLQueue;
+
+// 'key value' lines in a text file, keys are prefixed with the device.
+// Safe to use from the threads driving several devices.
+class TuneCache
+{
+public:
+	static TuneCache& get();
+
+	bool lookup(CLQueue& queue, const std::string& key, int& value);
+	void store(CLQueue& queue, const std::string& key, int value);
+
+	// device name and driver version, spaces replaced
+	static std::string deviceKey(CLQueue& queue);
+
+	std::string filename = "partikel.tune";
+
+protected:
+	void load();
+	void save();
+
+	std::map<std::string, int> values;
+	bool loaded = false;
+	std::mutex mutex;
+};
+
+#endif
@@ -10,7 +10,10 @@
 #include "tools/vectors.hpp"
 #include "tools/log.hpp"
 #include "compute/computeMain.hpp"
-#include "compute/gpuSort.hpp"
+#include "compute/glInterop.hpp"
+#include "sim/pbdSolver.hpp"
+#include "sim/nativeSolver.hpp"
+#include "sim/multiSolver.hpp"
 #include "sim/grid.hpp"
 #include "sim/semilagrange.hpp"
 #include "sim/mgsolve.hpp"
@@ -36,8 +39,52 @@ bool keyHandler(int key, int mods)
 }
 
 
-int main() 
+int main(int argc, char* argv[]) 
 {	
+	// --profile: per-kernel timings, a frame breakdown every 60 frames and a summary on exit
+	// --ooo: out-of-order queue, kernels scheduled by buffer dependencies
+	// --native: step on the host with the multithreaded C++ solver
+	// --morton: Z-order cell hash, currently slower than row-major on the native solver
+	// --tune-wg: time work-group sizes on the first frames, stored for later runs
+	// --device <cpu|gpu|index|name>: compute-only context without GL sharing
+	// --list-devices: print the device indices and exit
+	// --readback: download the particles to the host every frame
+	// --multi: split the domain between the GL device and the CPU device
+	bool profile = false;
+	bool native = false;
+	bool multi = false;
+	bool morton = false;
+	bool readback = false;
+	string device;
+	cl_command_queue_properties queueProps = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "--profile")
+			profile = true;
+		else if (arg == "--ooo")
+			queueProps |= CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE;
+		else if (arg == "--native")
+			native = true;
+		else if (arg == "--morton")
+			morton = true;
+		else if (arg == "--tune-wg")
+			CLKernel::autotune = true;
+		else if (arg == "--device" && i + 1 < argc)
+			device = argv[++i];
+		else if (arg == "--readback")
+			readback = true;
+		else if (arg == "--multi")
+			multi = true;
+		else if (arg == "--list-devices")
+		{
+			listDevices(cout);
+			return 0;
+		}
+	}
+	if (profile)
+		queueProps |= CL_QUEUE_PROFILING_ENABLE;
+
 	// Init Window
 	cout << "Partikel " << git_version_short << endl;
 	auto window = make_unique<GLWindow>(1000,1000);
@@ -45,16 +92,22 @@ int main()
 	
 	// Init CL
 	CLQueue cpuQueue, gpuQueue;
-	createQueues(cpuQueue, gpuQueue);
+	if (device.empty())
+		createQueues(cpuQueue, gpuQueue, queueProps);
+	else
+		createComputeQueue(gpuQueue, CLDeviceSelect::parse(device), queueProps);
 	auto& queue = gpuQueue;
+	CLProfiler profiler;
+	if (profile)
+		profiler.attach(queue);
 
 	// Particles
-	const float R = 0.01f;
+	PBDParams params;
+	params.mortonHash = morton;
+	const float R = params.radius;
 	Domain domain = { { 0, 0 }, {1024, 1024}, 2*R };
 	auto part1 = make_unique<DynamicParticles>(1024, BufferType::Both, queue);
-	auto part2 = make_unique<DynamicParticles>(1024, BufferType::Both, queue);
 	seedRandom(*part1, domain, 0.5f, 0.01f);
-	seedRandom(*part2, domain, 0.5f, 0.01f);
 	int parts = part1->size;
 
 	// Display handler
@@ -62,21 +115,15 @@ int main()
 	display.attach(part1.get(), "P0");
 	display.setRadius(R);
 
-	// Temporary buffers for sorting
-	int gridElems = domain.size.x * domain.size.y;
-	CLBuffer<cl_uint> cellStart(queue, gridElems, BufferType::Gpu); // hashgrid
-	CLBuffer<cl_uint> cellEnd(queue, gridElems, BufferType::Gpu);
-	CLBuffer<cl_uint2> sortArray(queue, parts, BufferType::Gpu); // (hash, part.index)
-	
-	// Kernels
-	CLKernel clPredict(queue, "particle.cl", "predictPosition");
-	CLKernel clAdvect(queue, "particle.cl", "finalAdvect");	
-	CLKernel clPrepareList(queue, "particle.cl", "prepareList");		
-	CLKernel clCalcCellBounds(queue, "particle.cl", "calcCellBoundsAndReorder");
-	CLKernel clCollide(queue, "collision.cl", "collide");
-	CLKernel clWallCollide(queue, "collision.cl", "wallCollideAndApply");
-	//BitonicSort sorter(queue);
-	RadixSort sorter(queue);
+	unique_ptr<PBDSolverBase> solver;
+	if (native)
+		solver = make_unique<NativePBDSolver>(domain, params);
+	else if (multi && !device.empty())
+		fatalError("--multi needs the CPU and GPU queue, not --device");
+	else if (multi)
+		solver = make_unique<MultiPBDSolver>(vector<CLQueue*> { &gpuQueue, &cpuQueue }, domain, params, parts);
+	else
+		solver = make_unique<PBDSolver>(queue, domain, params, parts);
 
 	auto tex = make_unique<Texture>("circle.png");
 	tex->bind();
@@ -84,82 +131,44 @@ int main()
 	int numIter = 4;
 
 	float dt = 1.0f / 60.0f * 0.1f;
-	const int wgSize = 64;
-	const int substeps = 3;
-	const int subcols = 1;
-	const int citer = 5;
+	int frame = 0;
 
+	// Pipelined: frame N+1 is enqueued and copied into the display's back buffer
+	// while frame N draws from the front one. Only the display copy is waited for.
 	while (window->poll())
 	{		
  		if (numIter-- <= 0 && 0)
 			break;
-		glFinish();
-		auto cur = part1.get();
-		auto alt = part2.get();
-		float localDt = dt / substeps;
-
-		for (int substep = 0; substep < substeps; substep++) {
-			// Predict particle position, apply gravity
-			clPredict.call(parts, wgSize, cur->p, cur->q, cur->v, localDt, parts);
-			clEnqueueBarrier(queue.handle);
-
-			for (int subcol = 0; subcol < subcols; subcol++) {
-				// Sort particles by cell hash
-				clPrepareList.call(parts, wgSize, cur->q, sortArray, domain, parts);
-				clEnqueueBarrier(queue.handle);
-				//sorter.sort(hash, hashSorted, particleIndex, particleIndexSorted, parts);
-				sorter.sort(sortArray, parts);
-				clEnqueueBarrier(queue.handle);
-
-				// Re-order particles and collect neighborhood information
-				cellStart.fill(0xFFFFFFFFU);
-				LocalBlock local((wgSize + 1) * sizeof(cl_uint));
-				clCalcCellBounds.call(parts, wgSize, sortArray, cellStart, cellEnd, local, parts,
-					cur->p, cur->q, cur->v, cur->invmass, cur->phase,
-					alt->p, alt->q, alt->v, alt->invmass, alt->phase);
-				clEnqueueBarrier(queue.handle);
-				swap(cur, alt);
-
-				// iterate on constraints
-				for (int iter = 0; iter < citer; iter++)
-				{
-					auto& delta = alt->q;
-					auto& counter = alt->phase;
-					counter.fill(0);
-					delta.fill({ 0, 0 });
-					clEnqueueBarrier(queue.handle);
-
-					// particle - particle collisions
-					const float SOR = 1.8f;
-					clCollide.call(parts, wgSize, cur->q, delta, cellStart, cellEnd,
-						cur->invmass, counter, R, domain, parts);
-					clEnqueueBarrier(queue.handle);
-
-					// add wall collision constraints, apply SOR Jacobi
-					clWallCollide.call(parts, wgSize, cur->q,
-						delta, cur->v, counter, 1.0f / localDt, R, domain, SOR, parts);
-					clEnqueueBarrier(queue.handle);
-				}
-			}
-
-			// apply position delta
-			clAdvect.call(parts, wgSize, cur->q, cur->v,
-				alt->p, alt->v, 1.0f / localDt, parts);
-			clEnqueueBarrier(queue.handle);
-			swap(cur, alt);			
-		}
+		// last frame's readback, the solver swaps the host vectors
+		part1->waitTransfers();
+		solver->step(*part1, dt);
+		if (native)
+			part1->upload();
+
 		// copy particles to display buffer
-		assert(cur == part1.get());
 		display.compute();
-		clFinish(queue.handle);
+		if (profile)
+		{
+			profiler.endFrame();
+			if (++frame % 60 == 0)
+				profiler.printFrame(cout);
+		}
 
-		part1->download();
+		// host copy for inspection
+		// the multi-device solver leaves an up to date host copy anyway
+		if (readback && !native && !multi)
+			part1->download(false);
 		window->clearBuffer();
 		glEnable(GL_BLEND);
 		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 		display.render();
 		window->swap();
 	}
+	clFinish(queue.handle);
+	part1->waitTransfers();
+
+	if (profile)
+		profiler.printSummary(cout);
 
 	return 0;	
 }
@@ -1,12 +1,15 @@
 #include "particle.h"
 
-__kernel void collide(
+PARTICLE_KERNEL void collide(
 	__global float2* q,
 	__global float2* d,
 	__global uint* cellStart, __global uint* cellEnd,
+	__global uint* cellKeys, uint tableMask,
 	__global float* weight, __global uint* count,
 	float radius, struct Domain domain, uint num)
 {
+	radius = RADIUS_ARG(radius);
+	SPECIALIZE_DOMAIN(domain);
 	uint tid = get_global_id(0);
 	if (tid >= num)
 		return;
@@ -14,6 +17,7 @@ __kernel void collide(
 	uint cnt = count[tid];
 	float2 delta = d[tid];
 	float2 pos1 = q[tid];
+	float w1 = weight[tid];
 	int2 cell = getGridPos(pos1, domain);
 
 	float R2 = 4.0 * radius * radius;
@@ -22,14 +26,17 @@ __kernel void collide(
 	for (int x = -1; x <= 1; x++) 
 	{
 		uint hash = getGridHash(cell + (int2)(x,y), domain.size);
-		uint start = cellStart[hash];
-		//printf("%d: %d %d : %d - %d\n", tid, x, y, start, cellEnd[hash]);
+		uint slot = findCellSlot(hash, cellKeys, tableMask);
+		if (slot == EMPTY_CELL)
+			continue;
+		uint start = cellStart[slot];
+		//printf("%d: %d %d : %d - %d\n", tid, x, y, start, cellEnd[slot]);
 
 		// empty
-		if (start == 0xFFFFFFFFU)
+		if (start == EMPTY_CELL)
 			continue;
 
-		uint end = cellEnd[hash];
+		uint end = cellEnd[slot];
 		for (uint j = start; j < end; j++)
 		{
 			// don't collide with yourself
@@ -44,7 +51,7 @@ __kernel void collide(
 				continue;
 			float C = half_sqrt(len2) - 2.0f * radius;
 
-			float w1 = weight[tid], w2 = weight[j];
+			float w2 = weight[j];
 			float cn = w1 / (w1 + w2) * C;
 			float2 n = fast_normalize(diff);
 
@@ -59,7 +66,207 @@ __kernel void collide(
 	count[tid] = cnt;
 }
 
-__kernel void wallCollideAndApply(
+// Same as collide, but the candidates come from a neighbour list built by
+// buildNeighborList in neighbors.cl
+PARTICLE_KERNEL void collideList(
+	__global float2* q,
+	__global float2* d,
+	__global uint* neighbors, __global uint* numNeighbors,
+	__global float* weight, __global uint* count,
+	float radius, uint num)
+{
+	radius = RADIUS_ARG(radius);
+	uint tid = get_global_id(0);
+	if (tid >= num)
+		return;
+
+	uint cnt = count[tid];
+	float2 delta = d[tid];
+	float2 pos1 = q[tid];
+	float w1 = weight[tid];
+	float R2 = 4.0 * radius * radius;
+
+	uint list = numNeighbors[tid];
+	for (uint k = 0; k < list; k++)
+	{
+		uint j = neighbors[k * num + tid];
+		float2 pos2 = q[j];
+		float2 diff = pos1 - pos2;
+		float len2 = dot(diff, diff);
+
+		if (len2 > R2)
+			continue;
+		float C = half_sqrt(len2) - 2.0f * radius;
+
+		float w2 = weight[j];
+		float cn = w1 / (w1 + w2) * C;
+		float2 n = fast_normalize(diff);
+
+		delta.x -= cn * n.x;
+		delta.y -= cn * n.y;
+		cnt++;
+	}
+
+	d[tid] = delta;
+	count[tid] = cnt;
+}
+
+// Same as collide, but a work-group owns a COLLIDE_TILE^2 block of cells.
+// The block and its one-cell halo are staged into local memory once, and
+// every particle sorted into the block is resolved from there. Particles
+// that moved out of their block since the sort, or blocks that do not fit
+// into lpos/lw, take the global memory path. The summation order matches
+// collide, so results are identical.
+#ifndef COLLIDE_TILE
+#define COLLIDE_TILE 16
+#endif
+#define TILE_ROW (COLLIDE_TILE + 2)
+#define TILE_CELLS (TILE_ROW * TILE_ROW)
+
+// halo cell containing staged slot k
+inline uint findTileCell(__local uint* offset, uint k)
+{
+	uint lo = 0, hi = TILE_CELLS;
+	while (hi - lo > 1)
+	{
+		uint mid = (lo + hi) / 2;
+		if (offset[mid] <= k)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+PARTICLE_KERNEL void collideTiled(
+	__global float2* q,
+	__global float2* d,
+	__global uint* cellStart, __global uint* cellEnd,
+	__global uint* cellKeys, uint tableMask,
+	__global float* weight, __global uint* count,
+	float radius, struct Domain domain, uint num,
+	__local float2* lpos, __local float* lw, uint capacity)
+{
+	__local uint offset[TILE_CELLS + 1]; // staged slots per halo cell, scanned
+	__local uint first[TILE_CELLS];      // global index of each cell's first particle
+	radius = RADIUS_ARG(radius);
+	SPECIALIZE_DOMAIN(domain);
+
+	const uint lid = get_local_id(0);
+	const uint wgSize = get_local_size(0);
+	const uint tilesX = domain.size.x / COLLIDE_TILE;
+	const int2 origin = (int2)(get_group_id(0) % tilesX, get_group_id(0) / tilesX) * COLLIDE_TILE - 1;
+
+	// particle counts of the tile and its halo
+	for (uint c = lid; c < TILE_CELLS; c += wgSize)
+	{
+		uint hash = getGridHash(origin + (int2)(c % TILE_ROW, c / TILE_ROW), domain.size);
+		uint slot = findCellSlot(hash, cellKeys, tableMask);
+		uint start = (slot == EMPTY_CELL) ? EMPTY_CELL : cellStart[slot];
+		first[c] = start;
+		offset[c + 1] = (start == EMPTY_CELL) ? 0 : cellEnd[slot] - start;
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// the scan is short, one work-item is enough
+	if (lid == 0)
+	{
+		offset[0] = 0;
+		for (uint c = 0; c < TILE_CELLS; c++)
+			offset[c + 1] += offset[c];
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	const uint total = offset[TILE_CELLS];
+	const bool staged = total <= capacity;
+	if (staged)
+	{
+		for (uint k = lid; k < total; k += wgSize)
+		{
+			uint c = findTileCell(offset, k);
+			uint j = first[c] + k - offset[c];
+			lpos[k] = q[j];
+			lw[k] = weight[j];
+		}
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	const float R2 = 4.0 * radius * radius;
+	for (uint k = lid; k < total; k += wgSize)
+	{
+		// only particles sorted into the tile itself, the halo belongs to the neighbors
+		uint c = findTileCell(offset, k);
+		int2 home = (int2)(c % TILE_ROW, c / TILE_ROW);
+		if (home.x == 0 || home.y == 0 || home.x == TILE_ROW - 1 || home.y == TILE_ROW - 1)
+			continue;
+
+		uint tid = first[c] + k - offset[c];
+		uint cnt = count[tid];
+		float2 delta = d[tid];
+		float2 pos1 = staged ? lpos[k] : q[tid];
+		float w1 = staged ? lw[k] : weight[tid];
+		int2 cell = getGridPos(pos1, domain);
+
+		// tile-local cell of the current position, wrapped like the hash
+		int2 lc = (int2)((int)(((uint)cell.x & (domain.size.x - 1)) - (uint)origin.x),
+			(int)(((uint)cell.y & (domain.size.y - 1)) - (uint)origin.y));
+		bool inTile = staged && lc.x >= 1 && lc.y >= 1 &&
+			lc.x <= COLLIDE_TILE && lc.y <= COLLIDE_TILE;
+
+		for (int y = -1; y <= 1; y++)
+		for (int x = -1; x <= 1; x++)
+		{
+			uint start, end, base;
+			if (inTile)
+			{
+				uint nc = (lc.x + x) + (lc.y + y) * TILE_ROW;
+				start = offset[nc];
+				end = offset[nc + 1];
+				base = first[nc] - start;
+			}
+			else
+			{
+				uint hash = getGridHash(cell + (int2)(x,y), domain.size);
+				uint slot = findCellSlot(hash, cellKeys, tableMask);
+				if (slot == EMPTY_CELL)
+					continue;
+				start = cellStart[slot];
+				if (start == EMPTY_CELL)
+					continue;
+				end = cellEnd[slot];
+				base = 0;
+			}
+
+			for (uint j = start; j < end; j++)
+			{
+				// don't collide with yourself
+				if (j + base == tid)
+					continue;
+
+				float2 pos2 = inTile ? lpos[j] : q[j];
+				float2 diff = pos1 - pos2;
+				float len2 = dot(diff, diff);
+
+				if (len2 > R2)
+					continue;
+				float C = half_sqrt(len2) - 2.0f * radius;
+
+				float w2 = inTile ? lw[j] : weight[j];
+				float cn = w1 / (w1 + w2) * C;
+				float2 n = fast_normalize(diff);
+
+				delta.x -= cn * n.x;
+				delta.y -= cn * n.y;
+				cnt++;
+			}
+		}
+
+		d[tid] = delta;
+		count[tid] = cnt;
+	}
+}
+
+PARTICLE_KERNEL void wallCollideAndApply(
 	__global float2* q,
 	__global float2* d,
 	__global float2* v,
@@ -67,6 +274,9 @@ __kernel void wallCollideAndApply(
 	float invdt,
 	float R, struct Domain domain, float omega, uint num)
 {
+	R = RADIUS_ARG(R);
+	omega = SOR_OMEGA_ARG(omega);
+	SPECIALIZE_DOMAIN(domain);
 	uint tid = get_global_id(0);
 	if (tid >= num)
 		return;
@@ -100,3 +310,105 @@ __kernel void wallCollideAndApply(
 	q[tid] = p0 + delta * corr;
 	v[tid] += (invdt * corr) * delta;
 }
+
+// Gauss-Seidel alternative to collide + wallCollideAndApply. Cells are
+// coloured in a 3x3 pattern, one dispatch per colour and one work-item per
+// cell. Same-coloured cells are three cells apart, so the particles one
+// work-item moves are never read by another in the same dispatch. Each
+// particle applies its averaged constraint delta right away, later
+// particles see the update.
+PARTICLE_KERNEL void collideColor(
+	__global float2* q,
+	__global float2* v,
+	__global uint* cellStart, __global uint* cellEnd,
+	__global uint* cellKeys, uint tableMask,
+	__global float* weight,
+	float radius, struct Domain domain, uint color, float invdt, float omega)
+{
+	radius = RADIUS_ARG(radius);
+	omega = GS_OMEGA_ARG(omega);
+	SPECIALIZE_DOMAIN(domain);
+	const uint colorsX = (domain.size.x + 2) / 3;
+	const uint gid = get_global_id(0);
+	const int2 home = (int2)(gid % colorsX * 3 + color % 3, gid / colorsX * 3 + color / 3);
+	if ((uint)home.x >= domain.size.x || (uint)home.y >= domain.size.y)
+		return;
+
+	uint homeSlot = findCellSlot(getGridHash(home, domain.size), cellKeys, tableMask);
+	if (homeSlot == EMPTY_CELL)
+		return;
+	uint first = cellStart[homeSlot];
+	if (first == EMPTY_CELL)
+		return;
+	uint last = cellEnd[homeSlot];
+
+	const float R2 = 4.0 * radius * radius;
+	const float2 size = convert_float2(domain.size) * domain.dx - 2 * radius;
+
+	for (uint tid = first; tid < last; tid++)
+	{
+		float2 p0 = q[tid];
+		float w1 = weight[tid];
+		float2 delta = (float2)(0, 0);
+		uint cnt = 0;
+
+		// search around the home cell without wrapping: the 3x3 colouring only
+		// keeps cells of one colour apart inside the grid
+		for (int y = -1; y <= 1; y++)
+		for (int x = -1; x <= 1; x++) 
+		{
+			int2 cell = home + (int2)(x,y);
+			if ((uint)cell.x >= domain.size.x || (uint)cell.y >= domain.size.y)
+				continue;
+			uint slot = findCellSlot(getGridHash(cell, domain.size), cellKeys, tableMask);
+			if (slot == EMPTY_CELL)
+				continue;
+			uint start = cellStart[slot];
+			if (start == EMPTY_CELL)
+				continue;
+
+			uint end = cellEnd[slot];
+			for (uint j = start; j < end; j++)
+			{
+				if (j == tid)
+					continue;
+
+				float2 diff = p0 - q[j];
+				float len2 = dot(diff, diff);
+				if (len2 > R2)
+					continue;
+				float C = half_sqrt(len2) - 2.0f * radius;
+
+				float w2 = weight[j];
+				float cn = w1 / (w1 + w2) * C;
+				float2 n = fast_normalize(diff);
+
+				delta -= cn * n;
+				cnt++;
+			}
+		}
+
+		// wall collision
+		float2 pos = p0 - domain.offset - radius;
+		if (pos.x < 0) {
+			delta.x -= pos.x;
+			cnt++;
+		}
+		else if (pos.x > size.x) {
+			delta.x += size.x - pos.x;
+			cnt++;
+		}
+		if (pos.y < 0) {
+			delta.y -= pos.y;
+			cnt++;
+		}
+		else if (pos.y > size.y) {
+			delta.y += size.y - pos.y;
+			cnt++;
+		}
+
+		float corr = (cnt == 0) ? 0.0f : (omega / (float)cnt);
+		q[tid] = p0 + delta * corr;
+		v[tid] += (invdt * corr) * delta;
+	}
+}
@@ -0,0 +1,84 @@
+#include "particle.h"
+
+// Verlet neighbour lists: collect everything within 2R + skin once, and
+// rebuild only after some particle moved more than skin / 2.
+
+PARTICLE_KERNEL void buildNeighborList(
+	__global float2* q,
+	__global uint* cellStart, __global uint* cellEnd,
+	__global uint* cellKeys, uint tableMask,
+	__global uint* neighbors, __global uint* numNeighbors,
+	__global uint* status,
+	float cutoff, uint maxNeighbors, struct Domain domain, uint num)
+{
+	SPECIALIZE_DOMAIN(domain);
+	uint tid = get_global_id(0);
+	if (tid >= num)
+		return;
+
+	float2 pos1 = q[tid];
+	int2 cell = getGridPos(pos1, domain);
+	float cutoff2 = cutoff * cutoff;
+	uint cnt = 0;
+	// cells are 2R wide, with a skin the cutoff reaches further than the adjacent ones
+	int rings = (int)ceil(cutoff / domain.dx);
+
+	for (int y = -rings; y <= rings; y++)
+	for (int x = -rings; x <= rings; x++) 
+	{
+		uint hash = getGridHash(cell + (int2)(x,y), domain.size);
+		uint slot = findCellSlot(hash, cellKeys, tableMask);
+		if (slot == EMPTY_CELL)
+			continue;
+		uint start = cellStart[slot];
+		if (start == EMPTY_CELL)
+			continue;
+
+		uint end = cellEnd[slot];
+		for (uint j = start; j < end; j++)
+		{
+			if (j == tid)
+				continue;
+			float2 diff = pos1 - q[j];
+			if (dot(diff, diff) > cutoff2)
+				continue;
+
+			// strided layout, so neighbouring work-items read adjacent words
+			if (cnt < maxNeighbors)
+				neighbors[cnt * num + tid] = j;
+			cnt++;
+		}
+	}
+
+	numNeighbors[tid] = min(cnt, maxNeighbors);
+	// longest list, host grows the table and rebuilds on overflow
+	atomic_max(&status[1], cnt);
+}
+
+// squared displacement since the last build, as float bits (monotonic for positive floats)
+__kernel void maxDisplacement(
+	__global float2* q, __global float2* ref,
+	__global uint* status, __local float* scratch, uint num)
+{
+	uint tid = get_global_id(0);
+	uint lid = get_local_id(0);
+
+	float d2 = 0;
+	if (tid < num)
+	{
+		float2 diff = q[tid] - ref[tid];
+		d2 = dot(diff, diff);
+	}
+	scratch[lid] = d2;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (uint s = get_local_size(0) / 2; s > 0; s >>= 1)
+	{
+		if (lid < s)
+			scratch[lid] = max(scratch[lid], scratch[lid + s]);
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	if (lid == 0)
+		atomic_max(&status[0], as_uint(scratch[0]));
+}
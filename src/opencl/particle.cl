@@ -2,7 +2,7 @@
 
 // Basic particle dynamics
 
-__kernel void predictPosition(
+PARTICLE_KERNEL void predictPosition(
 	__global float2* p, __global float2* q, 
 	__global float2* v,
 	float dt, uint num)
@@ -22,7 +22,7 @@ __kernel void predictPosition(
 	v[tid] = vel;
 }
 
-__kernel void finalAdvect(
+PARTICLE_KERNEL void finalAdvect(
 	__global float2* q, // in: pos
 	//__global float2* q, // in: xstar
 	__global float2* v, // in: velocity
@@ -47,11 +47,12 @@ __kernel void finalAdvect(
 	nv[tid] = v[tid];
 }
 
-__kernel void prepareList(
+PARTICLE_KERNEL void prepareList(
 	__global float2* p,
 	__global uint2* sortArray,
 	struct Domain domain, uint num)
 {
+	SPECIALIZE_DOMAIN(domain);
 	size_t tid = get_global_id(0);
 	if (tid >= num)
 		return;
@@ -60,9 +61,87 @@ __kernel void prepareList(
 	sortArray[tid] = (uint2)(getGridHash(pos, domain.size), tid);
 }
 
+// Coherent re-sort: sortArray still holds the sorted keys of the last sort,
+// flag the particles whose cell hash changed since
+__kernel void prepareListCoherent(
+	__global float2* p,
+	__global uint2* sortArray,
+	__global uint* changed,
+	struct Domain domain, uint num)
+{
+	SPECIALIZE_DOMAIN(domain);
+	size_t tid = get_global_id(0);
+	if (tid >= num)
+		return;
+
+	int2 pos = getGridPos(p[tid], domain);
+	uint hash = getGridHash(pos, domain.size);
+	changed[tid] = (hash != sortArray[tid].x) ? 1 : 0;
+	sortArray[tid] = (uint2)(hash, tid);
+}
+
+// changedScan: inclusive scan of the flags. Kept entries stay sorted by
+// themselves, moved ones go to the front of their own array.
+__kernel void splitChanged(
+	__global uint2* sortArray,
+	__global uint* changedScan,
+	__global uint2* kept, __global uint2* moved,
+	__global uint* status, uint num)
+{
+	size_t tid = get_global_id(0);
+	if (tid >= num)
+		return;
+
+	uint before = (tid > 0) ? changedScan[tid - 1] : 0;
+	if (changedScan[tid] != before)
+		moved[before] = sortArray[tid];
+	else
+		kept[tid - before] = sortArray[tid];
+
+	if (tid == num - 1)
+		status[0] = changedScan[tid];
+}
+
+// entries of a[0..n) with key below (or not above, for upper) the given key
+inline uint rankOf(__global uint2* a, uint n, uint key, bool upper)
+{
+	uint lo = 0, hi = n;
+	while (lo < hi)
+	{
+		uint mid = (lo + hi) / 2;
+		if (a[mid].x < key || (upper && a[mid].x == key))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+// merge path: every entry finds its place by its rank in the other array,
+// kept entries go first on equal keys
+__kernel void mergeChanged(
+	__global uint2* kept, uint numKept,
+	__global uint2* moved, uint numMoved,
+	__global uint2* sortArray)
+{
+	size_t tid = get_global_id(0);
+	if (tid < numKept)
+	{
+		uint2 entry = kept[tid];
+		sortArray[tid + rankOf(moved, numMoved, entry.x, false)] = entry;
+	}
+	else if (tid < numKept + numMoved)
+	{
+		uint j = tid - numKept;
+		uint2 entry = moved[j];
+		sortArray[j + rankOf(kept, numKept, entry.x, true)] = entry;
+	}
+}
+
 __kernel void calcCellBoundsAndReorder(
 	__global uint2* sortArray,
 	__global uint* cellStart, __global uint* cellEnd,
+	__global uint* cellKeys, uint tableMask,
 	__local uint* localHash, uint num,
 	__global float2* p,
 	__global float2* q,
@@ -94,19 +173,21 @@ __kernel void calcCellBoundsAndReorder(
 	barrier(CLK_LOCAL_MEM_FENCE);
 
 	if (tid < num){
+		uint slot0 = (tid == 0 || hash0 != localHash[loc] || tid == num - 1) ?
+			insertCellSlot(hash0, cellKeys, tableMask) : 0;
 		if (tid == 0) //Border case
 		{
-			cellStart[hash0] = 0;
+			cellStart[slot0] = 0;
 		}
 		else //Main case
 		{
 			if (hash0 != localHash[loc])
-				cellEnd[localHash[loc]] = cellStart[hash0] = tid;
+				cellEnd[insertCellSlot(localHash[loc], cellKeys, tableMask)] = cellStart[slot0] = tid;
 		};
 
 		//Another border case
 		if (tid == num - 1)
-			cellEnd[hash0] = num;
+			cellEnd[slot0] = num;
 
 		//Now use the sorted index to reorder the pos and vel arrays
 		uint sortedIndex = sortArray[tid].y;
@@ -118,3 +199,59 @@ __kernel void calcCellBoundsAndReorder(
 		ph2[tid] = ph[sortedIndex];
 	}
 }
+
+// Counting-sort binning: rank each particle within its cell slot.
+// The order inside a cell follows the atomics and is not deterministic.
+__kernel void binCount(
+	__global float2* q,
+	__global uint* cellCount,
+	__global uint* cellKeys, uint tableMask,
+	__global uint2* binArray,
+	struct Domain domain, uint num)
+{
+	SPECIALIZE_DOMAIN(domain);
+	size_t tid = get_global_id(0);
+	if (tid >= num)
+		return;
+
+	uint hash = getGridHash(getGridPos(q[tid], domain), domain.size);
+	uint slot = insertCellSlot(hash, cellKeys, tableMask);
+	binArray[tid] = (uint2)(slot, atomic_inc(&cellCount[slot]));
+}
+
+// cellEnd holds the counts, cellStart their exclusive scan
+__kernel void binCellEnd(
+	__global uint* cellStart, __global uint* cellEnd, uint cells)
+{
+	size_t tid = get_global_id(0);
+	if (tid >= cells)
+		return;
+
+	cellEnd[tid] += cellStart[tid];
+}
+
+__kernel void binReorder(
+	__global uint2* binArray,
+	__global uint* cellStart, uint num,
+	__global float2* p,
+	__global float2* q,
+	__global float2* v,
+	__global float* im, __global uint* ph,
+	__global float2* p2,
+	__global float2* q2,
+	__global float2* v2,
+	__global float* im2, __global uint* ph2)
+{
+	size_t tid = get_global_id(0);
+	if (tid >= num)
+		return;
+
+	uint2 bin = binArray[tid];
+	uint dst = cellStart[bin.x] + bin.y;
+
+	p2[dst] = p[tid];
+	q2[dst] = q[tid];
+	v2[dst] = v[tid];
+	im2[dst] = im[tid];
+	ph2[dst] = ph[tid];
+}
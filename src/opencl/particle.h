@@ -6,6 +6,39 @@ struct Domain {
 	float pad;
 };
 
+// Specialised builds (PBDParams::specialize) define the run constants of the
+// solver. Kernels still take them as arguments but overwrite them with the
+// defines, so the grid masks, sizes and radius fold into the code.
+#ifdef PARTICLE_WG
+#define PARTICLE_KERNEL __kernel __attribute__((reqd_work_group_size(PARTICLE_WG, 1, 1)))
+#else
+#define PARTICLE_KERNEL __kernel
+#endif
+
+#ifdef GRID_SIZE_X
+#define SPECIALIZE_DOMAIN(d) (d).size = (uint2)(GRID_SIZE_X, GRID_SIZE_Y); (d).dx = CELL_SIZE
+#else
+#define SPECIALIZE_DOMAIN(d)
+#endif
+
+#ifdef PARTICLE_RADIUS
+#define RADIUS_ARG(r) PARTICLE_RADIUS
+#else
+#define RADIUS_ARG(r) (r)
+#endif
+
+#ifdef SOR_OMEGA
+#define SOR_OMEGA_ARG(w) SOR_OMEGA
+#else
+#define SOR_OMEGA_ARG(w) (w)
+#endif
+
+#ifdef GS_OMEGA
+#define GS_OMEGA_ARG(w) GS_OMEGA
+#else
+#define GS_OMEGA_ARG(w) (w)
+#endif
+
 inline int2 getGridPos(float2 p, struct Domain domain)
 {
 	float x = (p.x - domain.offset.x) / domain.dx;
@@ -13,9 +46,83 @@ inline int2 getGridPos(float2 p, struct Domain domain)
 	return (int2)((int)x, (int)y);
 }
 
+#ifdef MORTON_HASH
+
+// spread the low 16 bits to the even bit positions
+inline uint spreadBits(uint v)
+{
+	v &= 0xFFFF;
+	v = (v | (v << 8)) & 0x00FF00FF;
+	v = (v | (v << 4)) & 0x0F0F0F0F;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+// Z-order over the square part of the grid, the longer axis stacks its
+// remaining bits on top
+inline uint getGridHash(int2 pos, uint2 gridSize)
+{
+	// wrap addressing
+	uint x = (uint)pos.x & (gridSize.x - 1);
+	uint y = (uint)pos.y & (gridSize.y - 1);
+	uint side = min(gridSize.x, gridSize.y);
+	uint bits = 31 - clz(side);
+	uint low = spreadBits(x & (side - 1)) | (spreadBits(y & (side - 1)) << 1);
+	return low | (((x | y) >> bits) << (2 * bits));
+}
+
+#else
+
 inline uint getGridHash(int2 pos, uint2 gridSize)
 {
 	// wrap addressing
 	return ((uint)pos.x & (gridSize.x - 1)) +
 		   ((uint)pos.y & (gridSize.y - 1)) * gridSize.x;
 }
+
+#endif
+
+#define EMPTY_CELL 0xFFFFFFFFU
+
+#ifdef COMPACT_CELLS
+
+// Open addressing table of the occupied cells with linear probing, sized
+// by particle count. cellStart/cellEnd are indexed by slot.
+inline uint cellSlotHash(uint hash, uint tableMask)
+{
+	// Fibonacci hashing, the high bits of the product mix all key bits
+	return (hash * 2654435769U) >> clz(tableMask);
+}
+
+// slot of the cell, EMPTY_CELL if it holds no particles
+inline uint findCellSlot(uint hash, __global uint* cellKeys, uint tableMask)
+{
+	for (uint slot = cellSlotHash(hash, tableMask);; slot = (slot + 1) & tableMask)
+	{
+		uint key = cellKeys[slot];
+		if (key == hash)
+			return slot;
+		if (key == EMPTY_CELL)
+			return EMPTY_CELL;
+	}
+}
+
+// slot of the cell, claimed if not present yet
+inline uint insertCellSlot(uint hash, __global uint* cellKeys, uint tableMask)
+{
+	for (uint slot = cellSlotHash(hash, tableMask);; slot = (slot + 1) & tableMask)
+	{
+		uint key = atomic_cmpxchg(&cellKeys[slot], EMPTY_CELL, hash);
+		if (key == EMPTY_CELL || key == hash)
+			return slot;
+	}
+}
+
+#else
+
+// direct table over the whole domain, the slot is the cell hash
+inline uint findCellSlot(uint hash, __global uint* cellKeys, uint tableMask) { return hash; }
+inline uint insertCellSlot(uint hash, __global uint* cellKeys, uint tableMask) { return hash; }
+
+#endif
@@ -0,0 +1,125 @@
+// Data-parallel building blocks: reduction, stream compaction, histogram,
+// pair layout conversion.
+// The scan lives in scan.cl. Keep REDUCE_WG in sync with primitives.hpp.
+
+#define REDUCE_WG 256
+
+#define REDUCE_SUM 0
+#define REDUCE_MIN 1
+#define REDUCE_MAX 2
+
+inline float combineFloat(float a, float b, uint op)
+{
+	return (op == REDUCE_SUM) ? a + b : (op == REDUCE_MIN) ? fmin(a, b) : fmax(a, b);
+}
+
+inline uint combineUint(uint a, uint b, uint op)
+{
+	return (op == REDUCE_SUM) ? a + b : (op == REDUCE_MIN) ? min(a, b) : max(a, b);
+}
+
+// Grid-stride accumulation per work-item, then a tree in local memory; one
+// partial per work-group. Run again on the partials with a single work-group.
+#define REDUCE_KERNEL(NAME, TIN, T, LOAD, COMBINE)                        \
+__kernel                                                                  \
+__attribute__((reqd_work_group_size(REDUCE_WG, 1, 1)))                    \
+void NAME(__global TIN* in, __global T* out, uint n, uint op, T identity) \
+{                                                                         \
+	__local T part[REDUCE_WG];                                            \
+	const uint lid = get_local_id(0);                                     \
+	T acc = identity;                                                     \
+	for (uint i = get_global_id(0); i < n; i += get_global_size(0))       \
+		acc = COMBINE(acc, LOAD(in[i]), op);                              \
+	part[lid] = acc;                                                      \
+	barrier(CLK_LOCAL_MEM_FENCE);                                         \
+	for (uint s = REDUCE_WG / 2; s > 0; s >>= 1)                          \
+	{                                                                     \
+		if (lid < s)                                                      \
+			part[lid] = COMBINE(part[lid], part[lid + s], op);            \
+		barrier(CLK_LOCAL_MEM_FENCE);                                     \
+	}                                                                     \
+	if (lid == 0)                                                         \
+		out[get_group_id(0)] = part[0];                                   \
+}
+
+#define LOAD_VALUE(x) (x)
+#define LOAD_NORM(x) length(x)
+
+REDUCE_KERNEL(reduceFloat, float, float, LOAD_VALUE, combineFloat)
+REDUCE_KERNEL(reduceUint, uint, uint, LOAD_VALUE, combineUint)
+REDUCE_KERNEL(reduceNorm, float2, float, LOAD_NORM, combineFloat)
+
+// flagScan: inclusive scan of 0/1 flags; writes the indices of the set ones
+__kernel void compactIndices(
+	__global uint* flags, __global uint* flagScan,
+	__global uint* indices, __global uint* count, uint n)
+{
+	size_t tid = get_global_id(0);
+	if (tid >= n)
+		return;
+
+	if (flags[tid])
+		indices[flagScan[tid] - 1] = tid;
+	if (tid == n - 1)
+		count[0] = flagScan[tid];
+}
+
+// bins in local memory, merged into the global counts once per work-group
+__kernel void histogramLocal(
+	__global uint* keys, __global uint* bins,
+	__local uint* localBins, uint n, uint numBins)
+{
+	const uint lid = get_local_id(0);
+	for (uint b = lid; b < numBins; b += get_local_size(0))
+		localBins[b] = 0;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (uint i = get_global_id(0); i < n; i += get_global_size(0))
+	{
+		uint key = keys[i];
+		if (key < numBins)
+			atomic_inc(&localBins[key]);
+	}
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	for (uint b = lid; b < numBins; b += get_local_size(0))
+		if (localBins[b])
+			atomic_add(&bins[b], localBins[b]);
+}
+
+// too many bins for local memory
+__kernel void histogramGlobal(
+	__global uint* keys, __global uint* bins, uint n, uint numBins)
+{
+	size_t tid = get_global_id(0);
+	if (tid >= n)
+		return;
+
+	uint key = keys[tid];
+	if (key < numBins)
+		atomic_inc(&bins[key]);
+}
+
+// (key, value) pairs to separate arrays, padded with maximal keys
+__kernel void splitPairs(
+	__global uint2* pairs, __global uint* keys, __global uint* values,
+	uint n, uint padded)
+{
+	size_t tid = get_global_id(0);
+	if (tid >= padded)
+		return;
+
+	uint2 pair = (tid < n) ? pairs[tid] : (uint2)(0xFFFFFFFFU, 0xFFFFFFFFU);
+	keys[tid] = pair.x;
+	values[tid] = pair.y;
+}
+
+__kernel void joinPairs(
+	__global uint* keys, __global uint* values, __global uint2* pairs, uint n)
+{
+	size_t tid = get_global_id(0);
+	if (tid >= n)
+		return;
+
+	pairs[tid] = (uint2)(keys[tid], values[tid]);
+}
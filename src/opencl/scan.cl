@@ -0,0 +1,54 @@
+// Prefix scan of uint arrays: per-block scan, scan of the block sums,
+// then block offsets added back. Keep SCAN_BLOCK in sync with gpuScan.hpp.
+
+#define SCAN_WG 256
+#define SCAN_PER_ITEM 4
+#define SCAN_BLOCK (SCAN_WG * SCAN_PER_ITEM)
+
+__kernel
+__attribute__((reqd_work_group_size(SCAN_WG, 1, 1)))
+void scanBlocks(__global uint* in, __global uint* out, __global uint* blockSums, uint n, uint inclusive)
+{
+	__local uint sums[SCAN_WG];
+	const uint lid = get_local_id(0);
+	const uint base = get_group_id(0) * SCAN_BLOCK + lid * SCAN_PER_ITEM;
+
+	// each work-item owns consecutive elements
+	uint v[SCAN_PER_ITEM];
+	uint total = 0;
+	for (int i = 0; i < SCAN_PER_ITEM; i++)
+	{
+		v[i] = (base + i < n) ? in[base + i] : 0;
+		total += v[i];
+	}
+	sums[lid] = total;
+	barrier(CLK_LOCAL_MEM_FENCE);
+
+	// Hillis-Steele over the per-item totals
+	for (uint offset = 1; offset < SCAN_WG; offset <<= 1)
+	{
+		uint t = (lid >= offset) ? sums[lid - offset] : 0;
+		barrier(CLK_LOCAL_MEM_FENCE);
+		sums[lid] += t;
+		barrier(CLK_LOCAL_MEM_FENCE);
+	}
+
+	uint prefix = sums[lid] - total;
+	for (int i = 0; i < SCAN_PER_ITEM; i++)
+	{
+		uint next = prefix + v[i];
+		if (base + i < n)
+			out[base + i] = inclusive ? next : prefix;
+		prefix = next;
+	}
+
+	if (lid == SCAN_WG - 1)
+		blockSums[get_group_id(0)] = sums[lid];
+}
+
+__kernel void addBlockOffsets(__global uint* out, __global uint* blockOffsets, uint n)
+{
+	uint gid = get_global_id(0);
+	if (gid < n)
+		out[gid] += blockOffsets[gid / SCAN_BLOCK];
+}
@@ -5,7 +5,7 @@
 
 #include "sim/grid.hpp"
 #include "render/shader.hpp"
-#include "compute/computeMain.hpp"
+#include "compute/glInterop.hpp"
 
 class GLWindow;
 
@@ -9,9 +9,13 @@ DisplayParticle::DisplayParticle(CLQueue& queue, const Domain& domain, GLWindow&
 	window(window), domainMin(toVec2(domain.offset)), domainMax(toVec2(domain.offset) + toVec2(domain.size)*domain.dx), queue(queue)
 {
 	// display buffers
-	vaPart = make_unique<SingleVertexArray>();
-	vaPart->buffer.setSize(1024);
-	clPart = make_unique<CLVertexBuffer<float> >(queue, *vaPart);
+	for (auto& slot : slots)
+	{
+		slot.va = make_unique<SingleVertexArray>();
+		slot.va->buffer.setSize(1024);
+		if (queue.sharesGL)
+			slot.cl = make_unique<CLVertexBuffer<float> >(queue, *slot.va);
+	}
 
 	// shaders
 	particleShader = make_unique<ShaderProgram>("particle.vert", "billboard_uv.geom", "tex_shade.frag");
@@ -22,6 +26,16 @@ DisplayParticle::DisplayParticle(CLQueue& queue, const Domain& domain, GLWindow&
 	window.keyHandlers.push_back(bind(&DisplayParticle::keyHandler, this, placeholders::_1, placeholders::_2));
 }
 
+DisplayParticle::~DisplayParticle()
+{
+	for (auto& slot : slots)
+	{
+		slot.written.wait();
+		if (slot.drawn)
+			glDeleteSync(slot.drawn);
+	}
+}
+
 void DisplayParticle::compute()
 {
 	if (curSystem < 0 && !displayPartList.empty())
@@ -30,34 +44,61 @@ void DisplayParticle::compute()
 		changePart();
 	}
 	
-	if (curSystem >= 0)
+	Slot& back = slots[1 - front];
+	back.count = 0;
+	if (curSystem < 0)
+		return;
+	DynamicParticles* part = displayPartList[curSystem].part;
+	if (part->size <= 0)
+		return;
+
+	// GL has to be done with the buffer before CL takes it, usually it is by now
+	if (back.drawn)
+	{
+		glClientWaitSync(back.drawn, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+		glDeleteSync(back.drawn);
+		back.drawn = 0;
+	}
+
+	back.count = part->size;
+	if (!back.cl)
 	{
-		DynamicParticles* part = displayPartList[curSystem].part;
-		
-		if (part->size > 0)
-		{
-			size_t size = part->size * sizeof(cl_float2);
-			clPart->grow(part->size * 2);
-			clPart->acquire();
-			clTest(clEnqueueCopyBuffer(queue.handle, part->p.handle, clPart->handle, 0, 0, size, 0, 0, 0), "buffer copy x");
-			clPart->release();
-		}
+		// compute-only context: through the host
+		part->p.download();
+		back.va->buffer.setData(&part->p.buffer[0], part->size * sizeof(cl_float2));
+		return;
 	}
+
+	size_t size = part->size * sizeof(cl_float2);
+	back.cl->grow(part->size * 2);
+	back.cl->acquire();
+	CLCommand cmd(queue);
+	cmd.read(part->p.deps);
+	cmd.write(back.cl->deps);
+	cmd.prepare();
+	clTest(clEnqueueCopyBuffer(queue.handle, part->p.handle, back.cl->handle, 0, 0, size, 
+							   cmd.numWait(), cmd.wait(), cmd.event()), "buffer copy x");
+	cmd.complete("display copy");
+	back.written = back.cl->release();
+	clFlush(queue.handle);
 }
 
 void DisplayParticle::render()
 {	
-	// draw real grid
-	if (curSystem >= 0)
+	Slot& slot = slots[front];
+	if (slot.count > 0)
 	{
-		DynamicParticles* part = displayPartList[curSystem].part;
-		vaPart->bind();
-		vaPart->defineAttrib(0, GL_FLOAT, 2, 0, 0);
+		// only this frame's copy, the simulation of the next one keeps running
+		slot.written.wait();
+		slot.va->bind();
+		slot.va->defineAttrib(0, GL_FLOAT, 2, 0, 0);
 		particleShader->use();
 		uniformBillboardSize.set(radius);
 		uniformScale.set(Vec2(2.0f / domainMax.x, 2.0f / domainMax.y));
-		glDrawArrays(GL_POINTS, 0, (GLsizei)part->size);
+		glDrawArrays(GL_POINTS, 0, (GLsizei)slot.count);
+		slot.drawn = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 	}
+	front = 1 - front;
 }
 
 bool DisplayParticle::keyHandler(int key, int mods)
@@ -5,7 +5,7 @@
 
 #include "sim/particle.hpp"
 #include "render/shader.hpp"
-#include "compute/computeMain.hpp"
+#include "compute/glInterop.hpp"
 
 class GLWindow;
 
@@ -19,9 +19,12 @@ class DisplayParticle
 {
 public:
 	DisplayParticle(CLQueue& queue, const Domain& domain, GLWindow& window);
+	~DisplayParticle();
 
 	void attach(DynamicParticles* part, const std::string& name);
+	// draws the buffer filled by the previous compute, then swaps buffers
 	void render();
+	// enqueues the copy into the buffer not being drawn, doesn't wait for it
 	void compute();
 	void setRadius(float R) { radius = R; }
 protected:
@@ -34,8 +37,18 @@ protected:
 	Vec2 domainMax;
 	CLQueue& queue;
 	std::vector<DisplayPartInfo> displayPartList;
-	std::unique_ptr<SingleVertexArray> vaPart;
-	std::unique_ptr<CLVertexBuffer<cl_float> > clPart;
+
+	// double buffered, so GL draws one frame while CL fills the next
+	struct Slot
+	{
+		std::unique_ptr<SingleVertexArray> va;
+		std::unique_ptr<CLVertexBuffer<cl_float> > cl; // with GL sharing, else copied on the host
+		CLEvent written; // CL released the buffer
+		GLsync drawn = 0; // GL done reading
+		int count = 0;
+	};
+	Slot slots[2];
+	int front = 0; // drawn by render, the other one is written by compute
 	std::unique_ptr<ShaderProgram> particleShader;
 	ShaderArgument<Vec2> uniformScale;
 	ShaderArgument<float> uniformBillboardSize;
@@ -3,14 +3,19 @@
 #include "compute/opencl.hpp"
 #include <algorithm>
 #include <fstream>
+#include <chrono>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MG_SSE2
+#endif
 
 using namespace std;
 
-MGLevel::MGLevel(const Vec2i& size, float h, CLQueue& queue) :
+MGLevel::MGLevel(const Vec2i& size, float h, CLQueue& queue, BufferType type) :
 	h(h), dim(size),
-	u(size, 1, BufferType::Both, queue),
-	r(size, 1, BufferType::Both, queue),
-	b(size, 1, BufferType::Both, queue)
+	u(size, 1, type, queue),
+	r(size, 1, type, queue),
+	b(size, 1, type, queue)
 {
 }
 
@@ -33,7 +38,8 @@ inline bool isPowerOf2(int x)
 	return x != 0 && (x & (x - 1)) == 0;
 }
 
-MultigridPoisson::MultigridPoisson(const Vec2i& size, float h0, CLQueue& queue)
+MultigridPoisson::MultigridPoisson(const Vec2i& size, float h0, CLQueue& queue, BufferType type, int threads) :
+	pool(threads)
 {
 	if (!isPowerOf2(size.x) || !isPowerOf2(size.y))
 		fatalError("Multigrid solver only supports 2^n grids.");
@@ -47,10 +53,11 @@ MultigridPoisson::MultigridPoisson(const Vec2i& size, float h0, CLQueue& queue)
 	float h = h0;
 	while (lSize.x > 4 && lSize.y > 4)
 	{
-		levels.emplace_back(new MGLevel(lSize, h, queue));
+		levels.emplace_back(new MGLevel(lSize, h, queue, type));
 		lSize = Vec2i(lSize.x / 2, lSize.y / 2);
 		h *= 2.0f;
 	}
+	relaxTime.assign(levels.size(), 0);
 	cout << levels.size() << " levels generated" << endl;
 }
 
@@ -313,14 +320,102 @@ void MultigridPoisson::relaxCPU(Grid1f& u, Grid1f& b, const Vec2i& size, float h
 	}
 }
 
+// Same update as relaxCPU for the rows [begin, end). The boundary columns are
+// peeled off so the interior has a single M; with SSE2 the interior is done
+// four cells at a time and the other colour is masked back to its old value.
+// Updates of one colour only read the other, so rows are independent.
+void MultigridPoisson::relaxRows(Grid1f& u, Grid1f& b, const Vec2i& size, float h, int redBlack, int begin, int end)
+{
+	const float h2 = sq(h);
+	const int DY = u.stride();
+	const int last = size.x - 1;
+
+	for (int j = begin; j < end; j++)
+	{
+		const int i_start = (j + redBlack) % 2;
+		float* rowU = u.ptr(0, j);
+		const float* rowB = b.ptr(0, j);
+		float M0 = 4;
+		if (j == 0)
+			M0 += bcNegY.M;
+		else if (j == size.y - 1)
+			M0 += bcPosY.M;
+
+		auto update = [&](int i, float M) {
+			float* ptrU = rowU + i;
+			float u0 = *ptrU;
+			float eq = ptrU[-1] + ptrU[1] + ptrU[-DY] + ptrU[DY] - h2 * rowB[i] - 4 * u0;
+			*ptrU = u0 + omega * eq / M;
+		};
+
+		// peeled boundary columns
+		if (i_start == 0)
+			update(0, M0 + bcNegX.M);
+		if ((last - i_start) % 2 == 0)
+			update(last, M0 + bcPosX.M);
+
+		// interior [1, last)
+		const float w = omega / M0;
+		int i = 1;
+#ifdef MG_SSE2
+		// lane k holds column i + k, i stays odd so the mask is fixed per row.
+		// The horizontal neighbours are shuffled together from registers, loading
+		// them at ptrU -+ 1 would overlap the previous store and stall forwarding.
+		const __m128 mask = i_start ? 
+			_mm_castsi128_ps(_mm_setr_epi32(-1, 0, -1, 0)) : _mm_castsi128_ps(_mm_setr_epi32(0, -1, 0, -1));
+		const __m128 vw = _mm_set1_ps(w), vh2 = _mm_set1_ps(h2), four = _mm_set1_ps(4);
+		__m128 prev = _mm_set1_ps(rowU[0]); // column 0, only lane 3 is used
+		for (; i + 4 <= last; i += 4)
+		{
+			float* ptrU = rowU + i;
+			__m128 u0 = _mm_loadu_ps(ptrU);
+			__m128 next = _mm_load_ss(ptrU + 4);
+			// (prev.w, u0.x, u0.y, u0.z) and (u0.y, u0.z, u0.w, next.x)
+			__m128 t = _mm_shuffle_ps(prev, u0, _MM_SHUFFLE(1, 0, 3, 3));
+			__m128 left = _mm_shuffle_ps(t, u0, _MM_SHUFFLE(2, 1, 2, 0));
+			t = _mm_shuffle_ps(u0, next, _MM_SHUFFLE(0, 0, 3, 3));
+			__m128 right = _mm_shuffle_ps(u0, t, _MM_SHUFFLE(2, 0, 2, 1));
+
+			__m128 sum = _mm_add_ps(_mm_add_ps(left, right), 
+									_mm_add_ps(_mm_loadu_ps(ptrU - DY), _mm_loadu_ps(ptrU + DY)));
+			__m128 eq = _mm_sub_ps(_mm_sub_ps(sum, _mm_mul_ps(vh2, _mm_loadu_ps(rowB + i))), _mm_mul_ps(four, u0));
+			__m128 un = _mm_add_ps(u0, _mm_mul_ps(vw, eq));
+			_mm_storeu_ps(ptrU, _mm_or_ps(_mm_and_ps(mask, un), _mm_andnot_ps(mask, u0)));
+			// the other colour keeps its old value, so u0 is still valid as left neighbour
+			prev = u0;
+		}
+#endif
+		// remaining interior cells of this colour
+		for (i += (i + i_start) % 2; i < last; i += 2)
+		{
+			float* ptrU = rowU + i;
+			float u0 = *ptrU;
+			float eq = ptrU[-1] + ptrU[1] + ptrU[-DY] + ptrU[DY] - h2 * rowB[i] - 4 * u0;
+			*ptrU = u0 + w * eq;
+		}
+	}
+}
+
 void MultigridPoisson::relax(int level, int iterations, bool reverse)
 {
+	MGLevel& l = *levels[level];
+	auto start = chrono::high_resolution_clock::now();
 	for (int iters = 0; iters < iterations; iters++) 
 	{
 		for (int redBlack = 0; redBlack < 2; redBlack++) 
 		{
-			relaxCPU(levels[level]->u, levels[level]->b, levels[level]->dim, levels[level]->h, reverse ? (1 - redBlack) : redBlack);
+			int color = reverse ? (1 - redBlack) : redBlack;
+			if (!parallelRelax)
+			{
+				relaxCPU(l.u, l.b, l.dim, l.h, color);
+				continue;
+			}
+			// a few rows per task, coarse levels end up on one thread
+			pool.parallelFor(l.dim.y, [&](int begin, int end) {
+				relaxRows(l.u, l.b, l.dim, l.h, color, begin, end);
+			}, max(4, 16384 / l.dim.x));
 		}
 		applyBC(level);
 	}	
+	relaxTime[level] += chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
 }
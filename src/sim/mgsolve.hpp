@@ -7,10 +7,11 @@
 #include <memory>
 #include "tools/vectors.hpp"
 #include "sim/grid.hpp"
+#include "tools/threadPool.hpp"
 
 struct MGLevel 
 {
-	MGLevel(const Vec2i& size, float h, CLQueue& queue);
+	MGLevel(const Vec2i& size, float h, CLQueue& queue, BufferType type);
 
 	float h;
 	Vec2i dim;
@@ -32,7 +33,8 @@ class MultigridPoisson
 {
 public:
 	
-	MultigridPoisson(const Vec2i& size, float h, CLQueue& queue);
+	// the solver runs on the host, Host grids need no OpenCL context
+	MultigridPoisson(const Vec2i& size, float h, CLQueue& queue, BufferType type = BufferType::Both, int threads = 0);
 	bool solve(float& residual, float tolerance);
 	inline Grid1f& getB0() { return levels[0]->b; }
 	inline Grid1f& getU0() { return levels[0]->u; }
@@ -47,6 +49,12 @@ public:
 
 	BC bcPosX, bcNegX, bcPosY, bcNegY;
 
+	// rows split across the pool, SIMD interior; false: the scalar reference smoother
+	bool parallelRelax = true;
+	// accumulated smoothing wall time per level in seconds
+	std::vector<double> relaxTime;
+	ThreadPool pool;
+
 //protected:
 	void computeResidual(int level, float& linf, float& l2);
 	void restrictResidual(int level);
@@ -57,6 +65,7 @@ public:
 	void vcycle(int fine);
 	void applyBC(int level);
 	void relaxCPU(Grid1f& u, Grid1f& b, const Vec2i& size, float h, int redBlack);
+	void relaxRows(Grid1f& u, Grid1f& b, const Vec2i& size, float h, int redBlack, int begin, int end);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,210 @@
+#include "sim/multiSolver.hpp"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+
+using namespace std;
+
+// marks halo copies in the phase of the device particles, the kernels carry phase along unchanged
+static const cl_int GHOST_PHASE = 1 << 30;
+
+MultiPBDSolver::MultiPBDSolver(const vector<CLQueue*>& queues, const Domain& domain, const PBDParams& params,
+							   int maxParticles, int haloCells) :
+	PBDSolverBase(domain, params), pool((int)queues.size()), haloCells(haloCells)
+{
+	const int n = (int)queues.size();
+	const int rows = (int)domain.size.y;
+	if (n == 0)
+		fatalError("MultiPBDSolver needs at least one queue");
+	if (rows < n * haloCells)
+		fatalError("Domain too small for the number of slabs");
+
+	// the particle set of a device changes every step, so nothing may be kept across steps
+	PBDParams deviceParams = params;
+	deviceParams.skin = 0;
+	deviceParams.coherentSort = 0;
+
+	// every device works on the full domain and may end up with all particles
+	for (CLQueue* queue : queues)
+	{
+		Device dev;
+		dev.queue = queue;
+		dev.part.reset(new DynamicParticles(maxParticles, BufferType::Both, *queue));
+		dev.solver.reset(new PBDSolver(*queue, domain, deviceParams, maxParticles));
+		devices.push_back(move(dev));
+	}
+
+	for (int i = 0; i < n; i++)
+		boundaries.push_back(rows * i / n);
+	boundaries.push_back(rows);
+	deviceTime.assign(n, 0);
+	deviceParts.assign(n, 0);
+	rowCount.assign(rows, 0);
+}
+
+int MultiPBDSolver::row(const cl_float2& pos) const
+{
+	int y = (int)((pos.y - domain.offset.y) / domain.dx);
+	return min(max(y, 0), (int)domain.size.y - 1);
+}
+
+// Owned particles of every slab plus ghost copies of those within haloCells
+// rows of a neighbouring slab
+void MultiPBDSolver::distribute(const DynamicParticles& part)
+{
+	const int n = (int)devices.size();
+	const auto& p = part.p.buffer;
+	vector<int> owner(part.size), count(n, 0);
+	fill(deviceParts.begin(), deviceParts.end(), 0);
+	fill(rowCount.begin(), rowCount.end(), 0);
+	for (int i = 0; i < part.size; i++)
+	{
+		int r = row(p[i]);
+		int o = (int)(upper_bound(boundaries.begin(), boundaries.end(), r) - boundaries.begin()) - 1;
+		owner[i] = o;
+		rowCount[r]++;
+		deviceParts[o]++;
+		count[o]++;
+		if (o > 0 && r < boundaries[o] + haloCells)
+			count[o - 1]++;
+		if (o < n - 1 && r >= boundaries[o + 1] - haloCells)
+			count[o + 1]++;
+	}
+
+	vector<int> cursor(n, 0);
+	for (int d = 0; d < n; d++)
+		devices[d].part->setSize(count[d]);
+	auto put = [&](int d, int i, cl_int ghost) {
+		DynamicParticles& dst = *devices[d].part;
+		int k = cursor[d]++;
+		dst.p.buffer[k] = part.p.buffer[i];
+		dst.q.buffer[k] = part.q.buffer[i];
+		dst.v.buffer[k] = part.v.buffer[i];
+		dst.invmass.buffer[k] = part.invmass.buffer[i];
+		dst.phase.buffer[k] = part.phase.buffer[i] | ghost;
+	};
+	for (int i = 0; i < part.size; i++)
+	{
+		int r = row(p[i]), o = owner[i];
+		put(o, i, 0);
+		if (o > 0 && r < boundaries[o] + haloCells)
+			put(o - 1, i, GHOST_PHASE);
+		if (o < n - 1 && r >= boundaries[o + 1] - haloCells)
+			put(o + 1, i, GHOST_PHASE);
+	}
+}
+
+// Owned particles of every device back into part, ghosts are dropped
+void MultiPBDSolver::collect(DynamicParticles& part)
+{
+	int k = 0;
+	for (auto& dev : devices)
+	{
+		const DynamicParticles& src = *dev.part;
+		for (int i = 0; i < src.size; i++)
+		{
+			if (src.phase.buffer[i] & GHOST_PHASE)
+				continue;
+			if (k == part.size)
+				fatalError("More particles came back than were distributed");
+			part.p.buffer[k] = src.p.buffer[i];
+			part.q.buffer[k] = src.q.buffer[i];
+			part.v.buffer[k] = src.v.buffer[i];
+			part.invmass.buffer[k] = src.invmass.buffer[i];
+			part.phase.buffer[k] = src.phase.buffer[i];
+			k++;
+		}
+	}
+	if (k != part.size)
+		fatalError("Particles lost in the slab exchange");
+}
+
+// Move the slab boundaries so that each device gets a share of the particles
+// proportional to its measured throughput
+void MultiPBDSolver::rebalance(const DynamicParticles& part)
+{
+	const int n = (int)devices.size();
+	const int rows = (int)domain.size.y;
+	if (n < 2 || part.size == 0)
+		return;
+
+	// particles per second of every device, devices without a measurement get the mean
+	vector<double> speed(n, 0);
+	double known = 0;
+	int measured = 0;
+	for (int d = 0; d < n; d++)
+	{
+		if (deviceParts[d] > 0 && deviceTime[d] > 0)
+		{
+			speed[d] = deviceParts[d] / deviceTime[d];
+			known += speed[d];
+			measured++;
+		}
+	}
+	if (measured == 0)
+		return;
+	double total = 0;
+	for (int d = 0; d < n; d++)
+	{
+		if (speed[d] == 0)
+			speed[d] = known / measured;
+		total += speed[d];
+	}
+
+	// quantiles of the row histogram
+	double share = 0;
+	int r = 0, cumulative = 0;
+	for (int d = 1; d < n; d++)
+	{
+		share += speed[d - 1] / total;
+		const double target = share * part.size;
+		while (r < rows && cumulative + rowCount[r] <= target)
+			cumulative += rowCount[r++];
+
+		int b = boundaries[d] + (int)lround(damping * (r - boundaries[d]));
+		b = max(b, boundaries[d - 1] + haloCells);
+		b = min(b, rows - (n - d) * haloCells);
+		boundaries[d] = b;
+	}
+}
+
+void MultiPBDSolver::step(DynamicParticles& part, float dt)
+{
+	const int n = (int)devices.size();
+	beginStages();
+	distribute(part);
+	endStage("distribute");
+
+	pool.run(n, [&](int d) {
+		Device& dev = devices[d];
+		deviceTime[d] = 0;
+		// zero-sized transfers and launches are invalid
+		if (dev.part->size == 0)
+			return;
+		auto start = chrono::high_resolution_clock::now();
+		dev.part->upload();
+		dev.solver->step(*dev.part, dt);
+		dev.part->download();
+		deviceTime[d] = chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+	});
+	endStage("devices");
+
+	collect(part);
+	rebalance(part);
+	if (part.p.type == BufferType::Both)
+		part.upload();
+	endStage("collect");
+}
+
+void MultiPBDSolver::printBalance(ostream& str) const
+{
+	str << "device   rows              particles   ms/step" << endl;
+	for (size_t d = 0; d < devices.size(); d++)
+	{
+		str << setw(6) << d << setw(7) << boundaries[d] << " - " << setw(6) << boundaries[d + 1]
+			<< setw(16) << deviceParts[d] << fixed << setprecision(3) << setw(10) 
+			<< 1000.0 * deviceTime[d] << endl;
+		str.unsetf(ios::floatfield);
+	}
+}
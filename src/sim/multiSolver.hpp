@@ -0,0 +1,54 @@
+// PBD step split across several OpenCL devices
+
+#ifndef SIM_MULTISOLVER_HPP
+#define SIM_MULTISOLVER_HPP
+
+#include <vector>
+#include <memory>
+#include <iosfwd>
+#include "sim/pbdSolver.hpp"
+#include "tools/threadPool.hpp"
+
+// The domain is cut into horizontal slabs, one per device. Each device steps
+// the particles of its slab plus copies of the neighbouring slabs' particles
+// within haloCells rows, then only keeps its own. Particles change owner by
+// position between steps. The exchange goes through the host copy of part.
+// Slab boundaries follow the measured per-device step time.
+class MultiPBDSolver : public PBDSolverBase
+{
+public:
+	MultiPBDSolver(const std::vector<CLQueue*>& queues, const Domain& domain, const PBDParams& params,
+				   int maxParticles, int haloCells = 4);
+
+	void step(DynamicParticles& part, float dt) override;
+
+	void printBalance(std::ostream& str) const;
+
+	// first cell row of each slab, plus domain.size.y
+	std::vector<int> boundaries;
+	// last step per device in seconds, and the particles it owned
+	std::vector<double> deviceTime;
+	std::vector<int> deviceParts;
+	// fraction of the way to the balanced boundaries taken per step
+	float damping = 0.5f;
+
+protected:
+	struct Device
+	{
+		CLQueue* queue;
+		std::unique_ptr<DynamicParticles> part;
+		std::unique_ptr<PBDSolver> solver;
+	};
+
+	void distribute(const DynamicParticles& part);
+	void collect(DynamicParticles& part);
+	void rebalance(const DynamicParticles& part);
+	int row(const cl_float2& pos) const;
+
+	std::vector<Device> devices;
+	std::vector<int> rowCount; // particles per cell row at the last distribute
+	ThreadPool pool;
+	int haloCells;
+};
+
+#endif
@@ -0,0 +1,437 @@
+#include "sim/nativeSolver.hpp"
+#include <algorithm>
+#include <cmath>
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define NATIVE_SSE2
+#endif
+
+using namespace std;
+
+static const cl_uint EMPTY_CELL = 0xFFFFFFFFU;
+
+NativePBDSolver::NativePBDSolver(const Domain& domain, const PBDParams& params, int threads) :
+	PBDSolverBase(domain, params), pool(threads), sorter(pool)
+{
+	const cl_uint cells = domain.size.x * domain.size.y;
+	hashBits = 1;
+	while (hashBits < 32 && (1U << hashBits) < cells)
+		hashBits++;
+	cellStart.resize(cells);
+	cellEnd.resize(cells);
+
+	mortonBits = -1;
+	if (params.mortonHash)
+	{
+		mortonBits = 0;
+		while ((2U << mortonBits) <= min(domain.size.x, domain.size.y))
+			mortonBits++;
+	}
+}
+
+// same truncation and wrap addressing as getGridPos / getGridHash in particle.h
+static inline void gridPos(const cl_float2& p, const Domain& domain, int& x, int& y)
+{
+	x = (int)((p.x - domain.offset.x) / domain.dx);
+	y = (int)((p.y - domain.offset.y) / domain.dx);
+}
+
+static inline cl_uint spreadBits(cl_uint v)
+{
+	v &= 0xFFFF;
+	v = (v | (v << 8)) & 0x00FF00FF;
+	v = (v | (v << 4)) & 0x0F0F0F0F;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+// mortonBits: log2 of the shorter side for Z-order, negative for row-major
+static inline cl_uint gridHash(int x, int y, const cl_uint2& size, int mortonBits)
+{
+	cl_uint wx = (cl_uint)x & (size.x - 1), wy = (cl_uint)y & (size.y - 1);
+	if (mortonBits < 0)
+		return wx + wy * size.x;
+
+	cl_uint mask = (1U << mortonBits) - 1;
+	cl_uint low = spreadBits(wx & mask) | (spreadBits(wy & mask) << 1);
+	return low | (((wx | wy) >> mortonBits) << (2 * mortonBits));
+}
+
+void NativePBDSolver::step(DynamicParticles& part, float dt)
+{
+	num = part.size;
+	const size_t reserve = part.p.buffer.size();
+	keys.resize(num);
+	delta.resize(num);
+	counter.resize(num);
+	p2.resize(reserve);
+	q2.resize(reserve);
+	v2.resize(reserve);
+	im2.resize(reserve);
+	ph2.resize(reserve);
+
+	float localDt = dt / params.substeps;
+
+	beginStages();
+	for (int substep = 0; substep < params.substeps; substep++) {
+		// Predict particle position, apply gravity
+		predict(part, localDt);
+		endStage("predict");
+
+		for (int subcol = 0; subcol < params.subcols; subcol++) {
+			// Sort particles by cell hash
+			hash(part);
+			endStage("hash");
+			sorter.sort(keys, num, hashBits);
+			endStage("sort");
+
+			// Re-order particles and collect neighborhood information
+			calcCellBoundsAndReorder(part);
+			endStage("reorder");
+
+			// iterate on constraints
+			for (int iter = 0; iter < params.citer && params.gaussSeidel; iter++)
+			{
+				for (int color = 0; color < 9; color++)
+					collideColor(part, color, 1.0f / localDt);
+				endStage("gaussSeidel");
+			}
+			for (int iter = 0; iter < params.citer && !params.gaussSeidel; iter++)
+			{
+				// particle - particle collisions
+				collide(part);
+				endStage("collide");
+
+				// add wall collision constraints, apply SOR Jacobi
+				wallCollideAndApply(part, 1.0f / localDt);
+				endStage("wallCollide");
+			}
+		}
+
+		// apply position delta
+		auto& p = part.p.buffer;
+		auto& q = part.q.buffer;
+		pool.parallelFor(num, [&](int begin, int end) {
+			copy(q.begin() + begin, q.begin() + end, p.begin() + begin);
+		});
+		endStage("advect");
+	}
+}
+
+void NativePBDSolver::predict(DynamicParticles& part, float dt)
+{
+	const float* p = &part.p.buffer[0].x;
+	float* q = &part.q.buffer[0].x;
+	float* v = &part.v.buffer[0].x;
+
+	pool.parallelFor(num, [&](int begin, int end) {
+		int i = begin;
+#ifdef NATIVE_SSE2
+		// two particles per register
+		const __m128 vdt = _mm_set1_ps(dt);
+		const __m128 gravity = _mm_setr_ps(0, dt * -9.81f, 0, dt * -9.81f);
+		for (; i + 2 <= end; i += 2)
+		{
+			__m128 vel = _mm_add_ps(_mm_loadu_ps(v + 2 * i), gravity);
+			__m128 pos = _mm_loadu_ps(p + 2 * i);
+			_mm_storeu_ps(q + 2 * i, _mm_add_ps(pos, _mm_mul_ps(vdt, vel)));
+			_mm_storeu_ps(v + 2 * i, vel);
+		}
+#endif
+		for (; i < end; i++)
+		{
+			v[2 * i + 1] += dt * -9.81f;
+			q[2 * i] = p[2 * i] + dt * v[2 * i];
+			q[2 * i + 1] = p[2 * i + 1] + dt * v[2 * i + 1];
+		}
+	});
+}
+
+void NativePBDSolver::hash(DynamicParticles& part)
+{
+	const auto& q = part.q.buffer;
+	pool.parallelFor(num, [&](int begin, int end) {
+		for (int i = begin; i < end; i++)
+		{
+			int x, y;
+			gridPos(q[i], domain, x, y);
+			keys[i].x = gridHash(x, y, domain.size, mortonBits);
+			keys[i].y = (cl_uint)i;
+		}
+	});
+}
+
+void NativePBDSolver::calcCellBoundsAndReorder(DynamicParticles& part)
+{
+	pool.parallelFor((int)cellStart.size(), [&](int begin, int end) {
+		fill(cellStart.begin() + begin, cellStart.begin() + end, EMPTY_CELL);
+	}, 16384);
+
+	const auto& p = part.p.buffer;
+	const auto& q = part.q.buffer;
+	const auto& v = part.v.buffer;
+	const auto& im = part.invmass.buffer;
+	const auto& ph = part.phase.buffer;
+	pool.parallelFor(num, [&](int begin, int end) {
+		for (int i = begin; i < end; i++)
+		{
+			// each boundary is written by exactly one particle
+			cl_uint hash0 = keys[i].x;
+			if (i == 0 || keys[i - 1].x != hash0)
+				cellStart[hash0] = i;
+			if (i == num - 1 || keys[i + 1].x != hash0)
+				cellEnd[hash0] = i + 1;
+
+			cl_uint sortedIndex = keys[i].y;
+			p2[i] = p[sortedIndex];
+			q2[i] = q[sortedIndex];
+			v2[i] = v[sortedIndex];
+			im2[i] = im[sortedIndex];
+			ph2[i] = ph[sortedIndex];
+		}
+	});
+
+	part.p.buffer.swap(p2);
+	part.q.buffer.swap(q2);
+	part.v.buffer.swap(v2);
+	part.invmass.buffer.swap(im2);
+	part.phase.buffer.swap(ph2);
+}
+
+#ifdef NATIVE_SSE2
+// Corrections from the candidates [j, jend) on particle i at pos1 with weight w1,
+// four per register; returns where the scalar remainder starts
+static cl_uint contactBlocks(const cl_float2* q, const cl_float* weight, cl_uint i, const cl_float2& pos1, float w1,
+							 float radius, cl_uint j, cl_uint jend, float& dx, float& dy, int& cnt)
+{
+	const __m128 px = _mm_set1_ps(pos1.x), py = _mm_set1_ps(pos1.y);
+	const __m128 R2 = _mm_set1_ps(4.0f * radius * radius), twoR = _mm_set1_ps(2.0f * radius);
+	const __m128 vw1 = _mm_set1_ps(w1), zero = _mm_setzero_ps();
+	const __m128i self = _mm_set1_epi32((int)i), four = _mm_set1_epi32(4);
+	__m128i lane = _mm_setr_epi32((int)j, (int)j + 1, (int)j + 2, (int)j + 3);
+	__m128 sx = zero, sy = zero;
+	__m128i hits = _mm_setzero_si128();
+	for (; j + 4 <= jend; j += 4)
+	{
+		// (x0, y0, x1, y1), (x2, y2, x3, y3) to x and y vectors
+		__m128 a = _mm_loadu_ps(&q[j].x), b = _mm_loadu_ps(&q[j + 2].x);
+		__m128 diffx = _mm_sub_ps(px, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+		__m128 diffy = _mm_sub_ps(py, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+		__m128 len2 = _mm_add_ps(_mm_mul_ps(diffx, diffx), _mm_mul_ps(diffy, diffy));
+		// misses and i itself masked out
+		__m128 hit = _mm_andnot_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(lane, self)), _mm_cmple_ps(len2, R2));
+
+		// cn / len = w1 C / ((w1 + w2) len), a single division
+		__m128 len = _mm_sqrt_ps(len2);
+		__m128 num = _mm_mul_ps(vw1, _mm_sub_ps(len, twoR));
+		__m128 den = _mm_mul_ps(_mm_add_ps(vw1, _mm_loadu_ps(weight + j)), len);
+		// coincident particles count but don't push, the masks drop the 0 / 0
+		__m128 scale = _mm_and_ps(_mm_and_ps(hit, _mm_cmpgt_ps(len, zero)), _mm_div_ps(num, den));
+		sx = _mm_sub_ps(sx, _mm_mul_ps(scale, diffx));
+		sy = _mm_sub_ps(sy, _mm_mul_ps(scale, diffy));
+		hits = _mm_sub_epi32(hits, _mm_castps_si128(hit));
+		lane = _mm_add_epi32(lane, four);
+	}
+	float fx[4], fy[4];
+	int fc[4];
+	_mm_storeu_ps(fx, sx);
+	_mm_storeu_ps(fy, sy);
+	_mm_storeu_si128((__m128i*)fc, hits);
+	dx += (fx[0] + fx[1]) + (fx[2] + fx[3]);
+	dy += (fy[0] + fy[1]) + (fy[2] + fy[3]);
+	cnt += fc[0] + fc[1] + fc[2] + fc[3];
+	return j;
+}
+#endif
+
+// Sum of the particle-particle corrections for particle i, as in collide in collision.cl.
+// Searches the cells around (cx, cy), which wrap at the grid border only if wrap is set.
+inline void NativePBDSolver::contacts(const DynamicParticles& part, int i, int cx, int cy, bool wrap,
+	float& dx, float& dy, int& cnt) const
+{
+	const auto& q = part.q.buffer;
+	const auto& weight = part.invmass.buffer;
+	const float radius = params.radius;
+	const float R2 = 4.0f * radius * radius;
+
+	const cl_float2 pos1 = q[i];
+	const float w1 = weight[i];
+
+#ifdef NATIVE_SSE2
+	// With the row-major hash the three cells of a row follow each other in the
+	// sorted order unless they wrap. Rows with enough candidates for a register
+	// go through contactBlocks, cells are mostly too sparse on their own.
+	const bool joinRow = mortonBits < 0 && cx > 0 && cx + 1 < (int)domain.size.x;
+#endif
+
+	for (int y = -1; y <= 1; y++)
+	for (int x = -1; x <= 1; x++)
+	{
+		if (!wrap && ((cl_uint)(cx + x) >= domain.size.x || (cl_uint)(cy + y) >= domain.size.y))
+			continue;
+		cl_uint hash = gridHash(cx + x, cy + y, domain.size, mortonBits);
+		cl_uint j = cellStart[hash];
+		if (j == EMPTY_CELL)
+			continue;
+		cl_uint jend = cellEnd[hash];
+#ifdef NATIVE_SSE2
+		if (joinRow)
+		{
+			// extend to the end of the row, x is the first occupied cell in it
+			for (int k = x + 1; k <= 1; k++)
+				if (cellStart[hash + k - x] != EMPTY_CELL)
+					jend = cellEnd[hash + k - x];
+			x = 1;
+			if (j + 4 <= jend)
+				j = contactBlocks(&q[0], &weight[0], (cl_uint)i, pos1, w1, radius, j, jend, dx, dy, cnt);
+		}
+#endif
+
+		for (; j < jend; j++)
+		{
+			// don't collide with yourself
+			if (j == (cl_uint)i)
+				continue;
+
+			float diffx = pos1.x - q[j].x, diffy = pos1.y - q[j].y;
+			float len2 = diffx * diffx + diffy * diffy;
+			if (len2 > R2)
+				continue;
+			float len = sqrt(len2);
+			float C = len - 2.0f * radius;
+			float cn = w1 / (w1 + weight[j]) * C;
+			if (len > 0)
+			{
+				dx -= cn * diffx / len;
+				dy -= cn * diffy / len;
+			}
+			cnt++;
+		}
+	}
+}
+
+void NativePBDSolver::collide(DynamicParticles& part)
+{
+	pool.parallelFor(num, [&](int begin, int end) {
+		for (int i = begin; i < end; i++)
+		{
+			float dx = 0, dy = 0;
+			int cnt = 0;
+			int cx, cy;
+			gridPos(part.q.buffer[i], domain, cx, cy);
+			contacts(part, i, cx, cy, true, dx, dy, cnt);
+			delta[i].x = dx;
+			delta[i].y = dy;
+			counter[i] = cnt;
+		}
+	}, 256);
+}
+
+// One Gauss-Seidel sweep over the cells of a 3x3 colouring, see collideColor in collision.cl
+void NativePBDSolver::collideColor(DynamicParticles& part, int color, float invdt)
+{
+	auto& q = part.q.buffer;
+	auto& v = part.v.buffer;
+	const float R = params.radius;
+	const float omega = params.gsOmega;
+	const float offx = domain.offset.x + R, offy = domain.offset.y + R;
+	const float sizex = domain.size.x * domain.dx - 2 * R, sizey = domain.size.y * domain.dx - 2 * R;
+	const int rows = (domain.size.y + 2 - color / 3) / 3;
+
+	pool.parallelFor(rows, [&](int begin, int end) {
+		for (int row = begin; row < end; row++)
+		for (int hx = color % 3; hx < (int)domain.size.x; hx += 3)
+		{
+			// neighbours come from the home cell without wrapping, other cells
+			// of this colour are then never touched
+			const int hy = row * 3 + color / 3;
+			cl_uint hash = gridHash(hx, hy, domain.size, mortonBits);
+			cl_uint first = cellStart[hash];
+			if (first == EMPTY_CELL)
+				continue;
+
+			for (cl_uint i = first, last = cellEnd[hash]; i < last; i++)
+			{
+				float dx = 0, dy = 0;
+				int cnt = 0;
+				contacts(part, i, hx, hy, false, dx, dy, cnt);
+
+				// wall collision
+				float px = q[i].x - offx, py = q[i].y - offy;
+				if (px < 0) { dx -= px; cnt++; }
+				else if (px > sizex) { dx += sizex - px; cnt++; }
+				if (py < 0) { dy -= py; cnt++; }
+				else if (py > sizey) { dy += sizey - py; cnt++; }
+
+				float corr = (cnt == 0) ? 0.0f : (omega / (float)cnt);
+				q[i].x += dx * corr;
+				q[i].y += dy * corr;
+				v[i].x += (invdt * corr) * dx;
+				v[i].y += (invdt * corr) * dy;
+			}
+		}
+	}, 1);
+}
+
+void NativePBDSolver::wallCollideAndApply(DynamicParticles& part, float invdt)
+{
+	float* q = &part.q.buffer[0].x;
+	float* v = &part.v.buffer[0].x;
+	const float* d = &delta[0].x;
+	const float R = params.radius;
+	const float omega = params.omega;
+	const float offx = domain.offset.x + R, offy = domain.offset.y + R;
+	const float sizex = domain.size.x * domain.dx - 2 * R, sizey = domain.size.y * domain.dx - 2 * R;
+
+	pool.parallelFor(num, [&](int begin, int end) {
+		int i = begin;
+#ifdef NATIVE_SSE2
+		// two particles per register; walls push back by the penetration depth
+		const __m128 off = _mm_setr_ps(offx, offy, offx, offy);
+		const __m128 size = _mm_setr_ps(sizex, sizey, sizex, sizey);
+		const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+		const __m128 vomega = _mm_set1_ps(omega), vinvdt = _mm_set1_ps(invdt);
+		for (; i + 2 <= end; i += 2)
+		{
+			__m128 p0 = _mm_loadu_ps(q + 2 * i);
+			__m128 pos = _mm_sub_ps(p0, off);
+			__m128 delta = _mm_loadu_ps(d + 2 * i);
+			__m128 over = _mm_sub_ps(pos, size);
+			delta = _mm_sub_ps(delta, _mm_min_ps(pos, zero));
+			delta = _mm_sub_ps(delta, _mm_max_ps(over, zero));
+
+			// per-particle constraint count, in both lanes of the particle
+			__m128 hits = _mm_add_ps(_mm_and_ps(_mm_cmplt_ps(pos, zero), one),
+				_mm_and_ps(_mm_cmpgt_ps(over, zero), one));
+			hits = _mm_add_ps(hits, _mm_shuffle_ps(hits, hits, _MM_SHUFFLE(2, 3, 0, 1)));
+			__m128 cnt = _mm_add_ps(hits, _mm_setr_ps((float)counter[i], (float)counter[i],
+				(float)counter[i + 1], (float)counter[i + 1]));
+
+			__m128 corr = _mm_and_ps(_mm_cmpgt_ps(cnt, zero), _mm_div_ps(vomega, cnt));
+			__m128 step = _mm_mul_ps(delta, corr);
+			_mm_storeu_ps(q + 2 * i, _mm_add_ps(p0, step));
+			_mm_storeu_ps(v + 2 * i, _mm_add_ps(_mm_loadu_ps(v + 2 * i), _mm_mul_ps(vinvdt, step)));
+		}
+#endif
+		for (; i < end; i++)
+		{
+			float px = q[2 * i] - offx, py = q[2 * i + 1] - offy;
+			float dx = d[2 * i], dy = d[2 * i + 1];
+			int cnt = counter[i];
+
+			// wall collision
+			if (px < 0) { dx -= px; cnt++; }
+			else if (px > sizex) { dx += sizex - px; cnt++; }
+			if (py < 0) { dy -= py; cnt++; }
+			else if (py > sizey) { dy += sizey - py; cnt++; }
+
+			// apply SOR Jacobi
+			float corr = (cnt == 0) ? 0.0f : (omega / (float)cnt);
+			q[2 * i] += dx * corr;
+			q[2 * i + 1] += dy * corr;
+			v[2 * i] += (invdt * corr) * dx;
+			v[2 * i + 1] += (invdt * corr) * dy;
+		}
+	});
+}
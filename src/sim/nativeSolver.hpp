@@ -0,0 +1,51 @@
+// Native multithreaded C++ implementation of the PBD step
+
+#ifndef SIM_NATIVESOLVER_HPP
+#define SIM_NATIVESOLVER_HPP
+
+#include <vector>
+#include "sim/pbdSolver.hpp"
+#include "tools/threadPool.hpp"
+#include "compute/sorter.hpp"
+
+// Mirrors PBDSolver stage by stage, but works on the host side of the
+// particle buffers. The device copy is left untouched.
+class NativePBDSolver : public PBDSolverBase
+{
+public:
+	NativePBDSolver(const Domain& domain, const PBDParams& params, int threads = 0);
+
+	void step(DynamicParticles& part, float dt) override;
+
+	int threads() const { return pool.size(); }
+
+protected:
+	void predict(DynamicParticles& part, float dt);
+	void hash(DynamicParticles& part);
+	void calcCellBoundsAndReorder(DynamicParticles& part);
+	void contacts(const DynamicParticles& part, int i, int cx, int cy, bool wrap, float& dx, float& dy, int& cnt) const;
+	void collide(DynamicParticles& part);
+	void collideColor(DynamicParticles& part, int color, float invdt);
+	void wallCollideAndApply(DynamicParticles& part, float invdt);
+
+	ThreadPool pool;
+	HostRadixSort sorter;
+	int num = 0;
+	int hashBits;
+	int mortonBits; // negative for the row-major hash
+
+	// (hash, index) pairs
+	std::vector<cl_uint2> keys;
+	std::vector<cl_uint> cellStart, cellEnd;
+
+	// reorder targets, swapped with the particle buffers
+	std::vector<cl_float2> p2, q2, v2;
+	std::vector<cl_float> im2;
+	std::vector<cl_int> ph2;
+
+	// Jacobi accumulators
+	std::vector<cl_float2> delta;
+	std::vector<cl_int> counter;
+};
+
+#endif
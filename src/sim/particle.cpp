@@ -14,22 +14,49 @@ DynamicParticles::DynamicParticles(int reserve, BufferType type, CLQueue& queue)
 {
 }
 
-void DynamicParticles::upload()
+void DynamicParticles::upload(bool blocking)
 {
-	p.upload();
-	q.upload();
-	v.upload();
-	invmass.upload();
-	phase.upload();
+	waitTransfers();
+	if (blocking)
+	{
+		p.upload(size);
+		q.upload(size);
+		v.upload(size);
+		invmass.upload(size);
+		phase.upload(size);
+		return;
+	}
+	pending.push_back(p.uploadAsync(size));
+	pending.push_back(q.uploadAsync(size));
+	pending.push_back(v.uploadAsync(size));
+	pending.push_back(invmass.uploadAsync(size));
+	pending.push_back(phase.uploadAsync(size));
+}
+
+void DynamicParticles::download(bool blocking)
+{
+	waitTransfers();
+	if (blocking)
+	{
+		p.download(size);
+		q.download(size);
+		v.download(size);
+		invmass.download(size);
+		phase.download(size);
+		return;
+	}
+	pending.push_back(p.downloadAsync(size));
+	pending.push_back(q.downloadAsync(size));
+	pending.push_back(v.downloadAsync(size));
+	pending.push_back(invmass.downloadAsync(size));
+	pending.push_back(phase.downloadAsync(size));
 }
 
-void DynamicParticles::download()
+void DynamicParticles::waitTransfers()
 {
-	p.download();
-	q.download();
-	v.download();
-	invmass.download();
-	phase.download();
+	for (auto& e : pending)
+		e.wait();
+	pending.clear();
 }
 
 void DynamicParticles::setSize(int nsize)
@@ -42,11 +69,16 @@ void DynamicParticles::setSize(int nsize)
 		v.resize(nsize);
 		invmass.resize(nsize);
 		phase.resize(nsize);
-		reserve = nsize;
+		reserve = (int)p.reserve;
 	}
 }
 
 void seedRandom(DynamicParticles& parts, const Domain& domain, float density, float mass)
+{
+	seedRandomCount(parts, domain, (int)(domain.size.x * domain.size.y * density), mass);
+}
+
+void seedRandomCount(DynamicParticles& parts, const Domain& domain, int N, float mass)
 {
 	random_device rd;
 	mt19937 gen(rd());
@@ -54,7 +86,6 @@ void seedRandom(DynamicParticles& parts, const Domain& domain, float density, fl
 	uniform_real_distribution<float> uniformX(domain.offset.x, domain.offset.x + domain.dx * domain.size.x);
 	uniform_real_distribution<float> uniformY(domain.offset.y, domain.offset.y + domain.dx * domain.size.y);
 
-	int N = (int)(domain.size.x * domain.size.y * density);
 	parts.setSize(N);
 
 	for (int i = 0; i < N; i++)
@@ -68,5 +99,6 @@ void seedRandom(DynamicParticles& parts, const Domain& domain, float density, fl
 		parts.invmass.buffer[i] = 1.0f/mass;
 		parts.phase.buffer[i] = 0;
 	}
-	parts.upload();
+	if (parts.p.type == BufferType::Both)
+		parts.upload();
 }
\ No newline at end of file
@@ -25,15 +25,21 @@ public:
 class DynamicParticles : public ParticleBase {
 public:
 	DynamicParticles(int reserve, BufferType type, CLQueue& queue);
-	void upload();
-	void download();
+	// non-blocking transfers are finished by waitTransfers, keep the host side alone until then
+	void upload(bool blocking = true);
+	void download(bool blocking = true);
+	void waitTransfers();
 	void setSize(int nsize);
 	
 	CLBuffer<cl_float2> p, q, v;
 	CLBuffer<cl_float> invmass;
 	CLBuffer<cl_int> phase;
+
+private:
+	std::vector<CLEvent> pending;
 };
 
 void seedRandom(DynamicParticles& parts, const Domain& domain, float density, float mass);
+void seedRandomCount(DynamicParticles& parts, const Domain& domain, int count, float mass);
 
 #endif
\ No newline at end of file
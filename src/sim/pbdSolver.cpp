@@ -0,0 +1,456 @@
+#include "sim/pbdSolver.hpp"
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+using namespace std;
+
+// float as an exact OpenCL literal
+static string floatLiteral(float value)
+{
+	char text[64];
+	snprintf(text, sizeof(text), "%af", value);
+	return text;
+}
+
+// Cell hash layout and cell table type are build defines of the kernels;
+// specialised builds add the constants of the run.
+static CLDefines kernelDefines(const Domain& domain, const PBDParams& params)
+{
+	CLDefines defines;
+	if (params.mortonHash)
+		defines["MORTON_HASH"] = "1";
+	if (params.compactCells)
+		defines["COMPACT_CELLS"] = "1";
+	if (params.specialize)
+	{
+		defines["GRID_SIZE_X"] = to_string(domain.size.x) + "U";
+		defines["GRID_SIZE_Y"] = to_string(domain.size.y) + "U";
+		defines["CELL_SIZE"] = floatLiteral(domain.dx);
+		defines["PARTICLE_RADIUS"] = floatLiteral(params.radius);
+		defines["SOR_OMEGA"] = floatLiteral(params.omega);
+		defines["GS_OMEGA"] = floatLiteral(params.gsOmega);
+		defines["PARTICLE_WG"] = to_string(params.wgSize);
+	}
+	return defines;
+}
+
+// entries of the cell table: every cell, or a power of two at most half full
+static int cellTableSize(const Domain& domain, const PBDParams& params, int maxParticles)
+{
+	if (!params.compactCells)
+		return domain.size.x * domain.size.y;
+	int size = 1;
+	while (size < 2 * maxParticles)
+		size *= 2;
+	return size;
+}
+
+PBDSolver::PBDSolver(CLQueue& queue, const Domain& domain, const PBDParams& params, int maxParticles) :
+	PBDSolverBase(domain, params), queue(queue), defines(kernelDefines(domain, params)),
+	alt(maxParticles, BufferType::Gpu, queue),
+	delta(queue, maxParticles, BufferType::Gpu),
+	counter(queue, maxParticles, BufferType::Gpu),
+	cellStart(queue, cellTableSize(domain, params, maxParticles), BufferType::Gpu),
+	cellEnd(queue, cellTableSize(domain, params, maxParticles), BufferType::Gpu),
+	cellKeys(queue, params.compactCells ? cellTableSize(domain, params, maxParticles) : 1, BufferType::Gpu),
+	tableMask(params.compactCells ? cellTableSize(domain, params, maxParticles) - 1 : 0),
+	sortArray(queue, RadixSort::paddedSize(maxParticles), BufferType::Gpu),
+	sortBits(1),
+	changed(queue, params.coherentSort > 0 ? maxParticles : 1, BufferType::Gpu),
+	kept(queue, params.coherentSort > 0 ? maxParticles : 1, BufferType::Gpu),
+	moved(queue, params.coherentSort > 0 ? RadixSort::paddedSize(maxParticles) : 1, BufferType::Gpu),
+	neighbors(queue, params.skin > 0 ? maxParticles * params.maxNeighbors : 1, BufferType::Gpu),
+	numNeighbors(queue, maxParticles, BufferType::Gpu),
+	qRef(queue, maxParticles, BufferType::Gpu),
+	status(queue, 2, BufferType::Pinned),
+	maxNeighbors(params.maxNeighbors),
+	clPredict(queue, "particle.cl", "predictPosition", defines),
+	clAdvect(queue, "particle.cl", "finalAdvect", defines),
+	clPrepareList(queue, "particle.cl", "prepareList", defines),
+	clCalcCellBounds(queue, "particle.cl", "calcCellBoundsAndReorder", defines),
+	clCollide(queue, "collision.cl", "collide", defines),
+	clCollideTiled(queue, "collision.cl", "collideTiled", defines),
+	clWallCollide(queue, "collision.cl", "wallCollideAndApply", defines),
+	clBuildNeighbors(queue, "neighbors.cl", "buildNeighborList", defines),
+	clMaxDisplacement(queue, "neighbors.cl", "maxDisplacement", defines),
+	clCollideList(queue, "collision.cl", "collideList", defines),
+	clCollideColor(queue, "collision.cl", "collideColor", defines),
+	clBinCount(queue, "particle.cl", "binCount", defines),
+	clBinCellEnd(queue, "particle.cl", "binCellEnd", defines),
+	clBinReorder(queue, "particle.cl", "binReorder", defines),
+	clPrepareCoherent(queue, "particle.cl", "prepareListCoherent", defines),
+	clSplitChanged(queue, "particle.cl", "splitChanged", defines),
+	clMergeChanged(queue, "particle.cl", "mergeChanged", defines),
+	sorter(queue),
+	scan(queue)
+{
+	// cell hashes are below size.x * size.y, for both layouts
+	while (sortBits < 32 && (1ULL << sortBits) < (cl_ulong)domain.size.x * domain.size.y)
+		sortBits++;
+
+	// use at most half of local memory for staged particles, leave room for the cell tables
+	cl_ulong localMem = 0;
+	clTest(clGetDeviceInfo(queue.device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(localMem), &localMem, nullptr), 
+		"local memory size");
+	const int tileCells = (collideTile + 2) * (collideTile + 2);
+	cl_ulong budget = min(localMem / 2, localMem - 2 * tileCells * sizeof(cl_uint) - 1024);
+	tileCapacity = (cl_uint)(budget / (sizeof(cl_float2) + sizeof(cl_float)));
+}
+
+void PBDSolverBase::beginStages()
+{
+	if (!timeStages)
+		return;
+	sync();
+	stageStart = chrono::high_resolution_clock::now();
+}
+
+void PBDSolverBase::endStage(const char* name)
+{
+	if (!timeStages)
+		return;
+	sync();
+	auto now = chrono::high_resolution_clock::now();
+	stageTime[name] += chrono::duration<double>(now - stageStart).count();
+	stageStart = now;
+}
+
+void PBDSolver::sync()
+{
+	clFinish(queue.handle);
+}
+
+static void copyParticles(DynamicParticles& src, DynamicParticles& dst, int n)
+{
+	dst.p.copyFrom(src.p, n);
+	dst.q.copyFrom(src.q, n);
+	dst.v.copyFrom(src.v, n);
+	dst.invmass.copyFrom(src.invmass, n);
+	dst.phase.copyFrom(src.phase, n);
+}
+
+// status is pinned, mapping it avoids a copy on CPU devices and integrated GPUs
+void PBDSolver::readStatus(cl_uint* out)
+{
+	const cl_uint* st = status.map(false);
+	out[0] = st[0];
+	out[1] = st[1];
+	status.unmap();
+}
+
+// true if some particle moved more than half the skin since the lists were built
+bool PBDSolver::exceedsSkin(DynamicParticles& part, int parts)
+{
+	status.fill(0);
+	// tree reduction, wgSize has to be a power of two
+	clMaxDisplacement.call(parts, params.wgSize, readOnly(part.q), readOnly(qRef), status, 
+		LocalBlock(params.wgSize * sizeof(cl_float)), parts);
+	cl_uint st[2];
+	readStatus(st);
+
+	float maxDisp2;
+	memcpy(&maxDisp2, &st[0], sizeof(float));
+	return maxDisp2 > 0.25f * params.skin * params.skin;
+}
+
+void PBDSolver::buildNeighbors(DynamicParticles& part, int parts)
+{
+	for (;;)
+	{
+		if ((int)neighbors.size < parts * maxNeighbors)
+			neighbors.resize(parts * maxNeighbors);
+		status.fill(0);
+		clBuildNeighbors.call(parts, anyLocal(), readOnly(part.q), readOnly(cellStart), readOnly(cellEnd),
+			readOnly(cellKeys), tableMask, neighbors, numNeighbors, status, 
+			2 * params.radius + params.skin, (cl_uint)maxNeighbors, domain, parts);
+		cl_uint st[2];
+		readStatus(st);
+		if ((int)st[1] <= maxNeighbors)
+			break;
+		// lists were truncated, grow with some headroom and redo
+		maxNeighbors = (st[1] + 8) & ~7;
+	}
+	qRef.copyFrom(part.q, parts);
+	listSize = parts;
+	listBuilds++;
+}
+
+int PBDSolver::missingNeighbors(int& pairs)
+{
+	pairs = 0;
+	const int n = listSize;
+	if (n == 0)
+		return 0;
+	CLBuffer<cl_float2> ref(queue, n, BufferType::Both);
+	CLBuffer<cl_uint> list(queue, n * maxNeighbors, BufferType::Both);
+	CLBuffer<cl_uint> count(queue, n, BufferType::Both);
+	ref.copyFrom(qRef, n);
+	list.copyFrom(neighbors, n * maxNeighbors);
+	count.copyFrom(numNeighbors, n);
+	ref.download();
+	list.download();
+	count.download();
+
+	// bucket by cells of the cutoff width, so only adjacent cells can hold a neighbour
+	const float cutoff = 2 * params.radius + params.skin;
+	const int sx = max(1, (int)(domain.size.x * domain.dx / cutoff));
+	const int sy = max(1, (int)(domain.size.y * domain.dx / cutoff));
+	const auto& p = ref.buffer;
+	auto cellOf = [&](const cl_float2& pos, int& x, int& y) {
+		x = min(max((int)((pos.x - domain.offset.x) / cutoff), 0), sx - 1);
+		y = min(max((int)((pos.y - domain.offset.y) / cutoff), 0), sy - 1);
+	};
+	vector<int> cellStart(sx * sy + 1, 0), order(n);
+	int gx, gy;
+	for (int i = 0; i < n; i++)
+	{
+		cellOf(p[i], gx, gy);
+		cellStart[gy * sx + gx + 1]++;
+	}
+	for (int c = 0; c < sx * sy; c++)
+		cellStart[c + 1] += cellStart[c];
+	vector<int> fill(cellStart.begin(), cellStart.end() - 1);
+	for (int i = 0; i < n; i++)
+	{
+		cellOf(p[i], gx, gy);
+		order[fill[gy * sx + gx]++] = i;
+	}
+
+	// slightly inside the cutoff, pairs right at it may go either way in float
+	const float limit2 = 0.999f * cutoff * cutoff;
+	int missing = 0;
+	vector<cl_uint> own;
+	for (int i = 0; i < n; i++)
+	{
+		own.clear();
+		for (cl_uint k = 0; k < count.buffer[i]; k++)
+			own.push_back(list.buffer[k * n + i]);
+		sort(own.begin(), own.end());
+
+		int cx, cy;
+		cellOf(p[i], cx, cy);
+		for (int y = max(cy - 1, 0); y <= min(cy + 1, sy - 1); y++)
+		for (int x = max(cx - 1, 0); x <= min(cx + 1, sx - 1); x++)
+		for (int k = cellStart[y * sx + x]; k < cellStart[y * sx + x + 1]; k++)
+		{
+			int j = order[k];
+			float dx = p[i].x - p[j].x, dy = p[i].y - p[j].y;
+			if (j == i || dx * dx + dy * dy >= limit2)
+				continue;
+			pairs++;
+			if (!binary_search(own.begin(), own.end(), (cl_uint)j))
+				missing++;
+		}
+	}
+	return missing;
+}
+
+// Sort particles by cell hash, reorder into alt and collect neighborhood information
+void PBDSolver::sortByCell(DynamicParticles& cur, DynamicParticles& alt, int parts)
+{
+	const int wgSize = params.wgSize;
+	if (params.coherentSort > 0 && sortedSize == parts)
+	{
+		// the particles are still in the order of the last sort
+		clPrepareCoherent.call(parts, anyLocal(), readOnly(cur.q), sortArray, changed, domain, parts);
+		endStage("hash");
+		if (!resortChanged(parts))
+			sorter.sort(sortArray, parts, sortBits);
+	}
+	else
+	{
+		clPrepareList.call(parts, anyLocal(), readOnly(cur.q), sortArray, domain, parts);
+		endStage("hash");
+		sorter.sort(sortArray, parts, sortBits);
+	}
+	sortedSize = params.coherentSort > 0 ? parts : 0;
+	endStage("sort");
+
+	// the compact table only has to forget its keys, every claimed slot gets a start
+	if (params.compactCells)
+		cellKeys.fill(0xFFFFFFFFU);
+	else
+		cellStart.fill(0xFFFFFFFFU);
+	LocalBlock local((wgSize + 1) * sizeof(cl_uint));
+	clCalcCellBounds.call(parts, wgSize, readOnly(sortArray), cellStart, cellEnd, cellKeys, tableMask, 
+		local, parts,
+		readOnly(cur.p), readOnly(cur.q), readOnly(cur.v), readOnly(cur.invmass), readOnly(cur.phase),
+		alt.p, alt.q, alt.v, alt.invmass, alt.phase);
+	endStage("reorder");
+}
+
+// Sort the particles that changed cells and merge them into the unchanged ones,
+// which are still in order. False if too many changed, sortArray then holds
+// the unsorted (hash, index) pairs.
+bool PBDSolver::resortChanged(int parts)
+{
+	scan.inclusive(changed, changed, parts);
+	clSplitChanged.call(parts, anyLocal(), readOnly(sortArray), readOnly(changed), kept, moved, status, parts);
+	cl_uint st[2];
+	readStatus(st);
+	const int numMoved = (int)st[0];
+	if (numMoved > params.coherentSort * parts)
+		return false;
+
+	if (numMoved > 0)
+	{
+		sorter.sort(moved, numMoved, sortBits);
+		clMergeChanged.call(parts, anyLocal(), readOnly(kept), (cl_uint)(parts - numMoved), 
+			readOnly(moved), (cl_uint)numMoved, sortArray);
+	}
+	partialSorts++;
+	return true;
+}
+
+// Counting sort: count particles per cell slot, the exclusive scan of the counts
+// is cellStart, then scatter by rank. No sort passes over the particles, but a few
+// passes over the cell table; empty cells get an empty range instead of EMPTY_CELL.
+void PBDSolver::binByCell(DynamicParticles& cur, DynamicParticles& alt, int parts)
+{
+	const int cells = (int)cellStart.size;
+	if (params.compactCells)
+		cellKeys.fill(0xFFFFFFFFU);
+	cellEnd.fill(0);
+	clBinCount.call(parts, anyLocal(), readOnly(cur.q), cellEnd, cellKeys, tableMask, sortArray, domain, parts);
+	endStage("hash");
+	scan.exclusive(cellEnd, cellStart, cells);
+	clBinCellEnd.call(cells, anyLocal(), readOnly(cellStart), cellEnd, (cl_uint)cells);
+	endStage("sort");
+	clBinReorder.call(parts, anyLocal(), readOnly(sortArray), readOnly(cellStart), parts,
+		readOnly(cur.p), readOnly(cur.q), readOnly(cur.v), readOnly(cur.invmass), readOnly(cur.phase),
+		alt.p, alt.q, alt.v, alt.invmass, alt.phase);
+	endStage("reorder");
+}
+
+// One constraint iteration, recorded once per ping-pong state. Scalars that can
+// change between steps are bound by reference.
+const CLCommandList& PBDSolver::constraintIteration(DynamicParticles* cur)
+{
+	CLCommandList& list = iterations[cur];
+	if (!list.empty())
+		return list;
+
+	const int wgSize = params.wgSize;
+	const bool lists = (recordedConfig & 1) != 0;
+	const bool tiled = (recordedConfig & 2) != 0;
+	if (params.gaussSeidel)
+	{
+		// one sweep: each colour sees the positions the previous ones moved
+		const int colorCells = ((domain.size.x + 2) / 3) * ((domain.size.y + 2) / 3);
+		for (cl_uint color = 0; color < 9; color++)
+			list.add(clCollideColor, colorCells, anyLocal(), cur->q, cur->v, readOnly(cellStart), readOnly(cellEnd),
+				readOnly(cellKeys), cref(tableMask), readOnly(cur->invmass), cref(params.radius), cref(domain), color, 
+				cref(invDt), cref(params.gsOmega));
+		list.add([this]() { endStage("gaussSeidel"); });
+		return list;
+	}
+
+	list.fill(counter, 0);
+	list.fill(delta, { 0, 0 });
+
+	// particle - particle collisions
+	if (lists)
+		list.add(clCollideList, cref(numParts), anyLocal(), readOnly(cur->q), delta, readOnly(neighbors), 
+			readOnly(numNeighbors), readOnly(cur->invmass), counter, cref(params.radius), cref(numParts));
+	else if (tiled)
+	{
+		const int tiles = (domain.size.x / collideTile) * (domain.size.y / collideTile);
+		LocalBlock lpos(tileCapacity * sizeof(cl_float2)), lw(tileCapacity * sizeof(cl_float));
+		list.add(clCollideTiled, tiles * wgSize, wgSize, readOnly(cur->q), delta, readOnly(cellStart),
+			readOnly(cellEnd), readOnly(cellKeys), cref(tableMask), readOnly(cur->invmass), counter, cref(params.radius), 
+			cref(domain), cref(numParts), lpos, lw, tileCapacity);
+	}
+	else
+		list.add(clCollide, cref(numParts), anyLocal(), readOnly(cur->q), delta, readOnly(cellStart), readOnly(cellEnd),
+			readOnly(cellKeys), cref(tableMask), readOnly(cur->invmass), counter, cref(params.radius), cref(domain), 
+			cref(numParts));
+	list.add([this]() { endStage("collide"); });
+
+	// add wall collision constraints, apply SOR Jacobi
+	list.add(clWallCollide, cref(numParts), anyLocal(), cur->q,
+		readOnly(delta), cur->v, readOnly(counter), cref(invDt), cref(params.radius), cref(domain), 
+		cref(params.omega), cref(numParts));
+	list.add([this]() { endStage("wallCollide"); });
+	return list;
+}
+
+void PBDSolver::step(DynamicParticles& part, float dt)
+{
+	const int parts = part.size;
+	if (parts > alt.reserve)
+		fatalError("Particle count exceeds solver capacity");
+
+	auto cur = &part;
+	auto alt = &this->alt;
+	float localDt = dt / params.substeps;
+	// tiles cover the whole domain, which the compact table is meant to avoid
+	const bool tiled = params.tiledCollide && !params.compactCells &&
+		domain.size.x % collideTile == 0 && domain.size.y % collideTile == 0;
+	// Gauss-Seidel sweeps the cell grid and has no use for lists
+	const bool lists = params.skin > 0 && !params.gaussSeidel;
+	if (!lists || listSize != parts)
+		listSize = 0;
+
+	// recorded iterations bind the buffers of part and the kernel variant
+	const int config = (lists ? 1 : 0) | (tiled ? 2 : 0) | (params.gaussSeidel ? 4 : 0) | (params.autoLocal ? 8 : 0);
+	if (&part != recordedPart || config != recordedConfig)
+	{
+		iterations.clear();
+		recordedPart = &part;
+		recordedConfig = config;
+	}
+	numParts = parts;
+	invDt = 1.0f / localDt;
+
+	// No barriers needed: in-order queues serialize anyway, and on out-of-order
+	// queues the buffer arguments below define the dependencies.
+	beginStages();
+	for (int substep = 0; substep < params.substeps; substep++) {
+		// Predict particle position, apply gravity
+		clPredict.call(parts, anyLocal(), readOnly(cur->p), cur->q, cur->v, localDt, parts);
+		endStage("predict");
+
+		for (int subcol = 0; subcol < params.subcols; subcol++) {
+			// Neighbour lists stay valid, and the particle order with them, until
+			// some particle moved more than half the skin
+			bool resort = true;
+			if (lists && listSize != 0)
+			{
+				resort = exceedsSkin(*cur, parts);
+				endStage("skinCheck");
+			}
+			if (resort)
+			{
+				if (params.countingSort)
+					binByCell(*cur, *alt, parts);
+				else
+					sortByCell(*cur, *alt, parts);
+				swap(cur, alt);
+
+				if (lists)
+				{
+					buildNeighbors(*cur, parts);
+					endStage("neighbors");
+				}
+			}
+
+			// iterate on constraints
+			const CLCommandList& iteration = constraintIteration(cur);
+			for (int iter = 0; iter < params.citer; iter++)
+				iteration.run();
+		}
+
+		// apply position delta, in place so every array of cur stays in the sorted order
+		clAdvect.call(parts, anyLocal(), readOnly(cur->q), readOnly(cur->v),
+			cur->p, cur->v, 1.0f / localDt, parts);
+		endStage("advect");
+	}
+
+	// odd number of ping-pong swaps: move result back
+	if (cur != &part)
+	{
+		copyParticles(*cur, part, parts);
+		endStage("advect");
+	}
+}
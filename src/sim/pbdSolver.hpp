@@ -0,0 +1,146 @@
+// Position based dynamics step for particles
+
+#ifndef SIM_PBDSOLVER_HPP
+#define SIM_PBDSOLVER_HPP
+
+#include <map>
+#include <string>
+#include <chrono>
+#include "sim/particle.hpp"
+#include "compute/gpuSort.hpp"
+#include "compute/gpuScan.hpp"
+
+struct PBDParams
+{
+	float radius = 0.01f;
+	int substeps = 3;
+	int subcols = 1;  // re-sorts per substep
+	int citer = 5;    // constraint iterations per re-sort
+	float omega = 1.8f; // SOR factor
+	int wgSize = 64;          // fixed work-group size, see anyLocal
+	bool tiledCollide = true; // stage cell blocks in local memory, needs domain size % collideTile == 0
+	float skin = 0;           // Verlet neighbour list skin distance, 0: walk the cells every iteration
+	int maxNeighbors = 32;    // initial list length, grows on overflow
+	bool mortonHash = false;  // Z-order cell hash instead of row-major, fixed at construction
+	bool compactCells = false; // cell table sized by particle count instead of domain, fixed at construction
+	bool gaussSeidel = false; // 9-colour Gauss-Seidel instead of SOR Jacobi
+	float gsOmega = 1.0f;     // relaxation for gaussSeidel
+	bool countingSort = false; // bin by per-cell counts and a scan instead of the radix sort
+	float coherentSort = 0;    // partial re-sort up to this fraction of moved particles, 0: off
+	bool specialize = false;   // run constants as kernel defines, fixed at construction
+	bool autoLocal = true;     // tuned work-group sizes, see anyLocal
+};
+
+class PBDSolverBase
+{
+public:
+	PBDSolverBase(const Domain& domain, const PBDParams& params) : params(params), domain(domain) {}
+	virtual ~PBDSolverBase() {}
+
+	// advance all particles by dt, result ends up in part
+	virtual void step(DynamicParticles& part, float dt) = 0;
+	// wait for outstanding work
+	virtual void sync() {}
+
+	PBDParams params;
+	Domain domain;
+
+	// per-stage wall time in seconds; synchronizes after every stage
+	bool timeStages = false;
+	std::map<std::string, double> stageTime;
+
+protected:
+	void beginStages();
+	void endStage(const char* name);
+
+	std::chrono::high_resolution_clock::time_point stageStart;
+};
+
+// OpenCL implementation, particle data lives on the device
+class PBDSolver : public PBDSolverBase
+{
+public:
+	PBDSolver(CLQueue& queue, const Domain& domain, const PBDParams& params, int maxParticles);
+
+	void step(DynamicParticles& part, float dt) override;
+	void sync() override;
+
+	int listBuilds = 0;
+	int partialSorts = 0; // coherent re-sorts that did not fall back
+
+	// pairs within the cutoff at the last list build that the lists miss, checked on the host
+	int missingNeighbors(int& pairs);
+
+protected:
+	bool exceedsSkin(DynamicParticles& part, int parts);
+	void buildNeighbors(DynamicParticles& part, int parts);
+	void sortByCell(DynamicParticles& cur, DynamicParticles& alt, int parts);
+	void binByCell(DynamicParticles& cur, DynamicParticles& alt, int parts);
+	bool resortChanged(int parts);
+	void readStatus(cl_uint* out);
+	const CLCommandList& constraintIteration(DynamicParticles* cur);
+	// Local size for kernels that work with any: 0 picks the tuned size, see
+	// CLKernel::autotune. Without autoLocal every kernel runs with wgSize, and
+	// specialised builds require it through reqd_work_group_size. Kernels with
+	// local memory sized by wgSize pass it directly.
+	size_t anyLocal() const { return params.autoLocal && !params.specialize ? 0 : params.wgSize; }
+
+	CLQueue& queue;
+	CLDefines defines; // build defines of the solver's kernels
+	DynamicParticles alt;
+
+	// Jacobi accumulators, separate so alt keeps its particle data
+	CLBuffer<cl_float2> delta;
+	CLBuffer<cl_int> counter;
+
+	// temporary buffers for sorting
+	CLBuffer<cl_uint> cellStart, cellEnd; // hashgrid, indexed by cell or by table slot
+	CLBuffer<cl_uint> cellKeys; // cell hash per slot for compactCells
+	cl_uint tableMask;
+	CLBuffer<cl_uint2> sortArray; // (hash, part.index), or (slot, rank) for countingSort
+	int sortBits; // significant bits of the cell hash
+	int sortedSize = 0; // particles sortArray is valid for, 0: no coherent re-sort possible
+
+	// coherent re-sort: changed flags and their scan, unchanged and changed entries
+	CLBuffer<cl_uint> changed;
+	CLBuffer<cl_uint2> kept, moved;
+
+	// neighbour lists, indices into the sorted particle order
+	CLBuffer<cl_uint> neighbors, numNeighbors;
+	CLBuffer<cl_float2> qRef; // positions at the last build
+	CLBuffer<cl_uint> status; // max squared displacement bits or changed count, longest list
+	int maxNeighbors;
+	int listSize = 0; // particles covered by the current lists, 0: invalid
+
+	CLKernel clPredict;
+	CLKernel clAdvect;
+	CLKernel clPrepareList;
+	CLKernel clCalcCellBounds;
+	CLKernel clCollide;
+	CLKernel clCollideTiled;
+	CLKernel clWallCollide;
+	CLKernel clBuildNeighbors;
+	CLKernel clMaxDisplacement;
+	CLKernel clCollideList;
+	CLKernel clCollideColor;
+	CLKernel clBinCount;
+	CLKernel clBinCellEnd;
+	CLKernel clBinReorder;
+	CLKernel clPrepareCoherent;
+	CLKernel clSplitChanged;
+	CLKernel clMergeChanged;
+	RadixSort sorter;
+	PrefixScan scan;
+
+	static const int collideTile = 16; // COLLIDE_TILE in collision.cl
+	cl_uint tileCapacity; // particles staged per tile
+
+	// recorded constraint iterations by current particle set, valid for recordedPart and recordedConfig
+	std::map<DynamicParticles*, CLCommandList> iterations;
+	DynamicParticles* recordedPart = nullptr;
+	int recordedConfig = -1;
+	int numParts = 0; // of the running step, recorded by reference
+	float invDt = 0;  // 1 / substep dt, recorded by reference
+};
+
+#endif
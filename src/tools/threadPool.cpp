@@ -0,0 +1,101 @@
+#include "tools/threadPool.hpp"
+#include <algorithm>
+
+using namespace std;
+
+ThreadPool::ThreadPool(int threads)
+{
+	if (threads <= 0)
+		threads = max(1, (int)thread::hardware_concurrency());
+	for (int i = 1; i < threads; i++)
+		workers.emplace_back(&ThreadPool::worker, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		lock_guard<mutex> lock(poolMutex);
+		quit = true;
+	}
+	wake.notify_all();
+	for (auto& t : workers)
+		t.join();
+}
+
+void ThreadPool::worker()
+{
+	unsigned seen = 0;
+	unique_lock<mutex> lock(poolMutex);
+	for (;;)
+	{
+		wake.wait(lock, [&] { return quit || (task && generation != seen); });
+		if (quit)
+			return;
+		seen = generation;
+		active++;
+		lock.unlock();
+		int count = work();
+		lock.lock();
+		active--;
+		finished += count;
+		if (finished == numTasks && active == 0)
+			allDone.notify_all();
+	}
+}
+
+int ThreadPool::work()
+{
+	int count = 0;
+	for (int i = next++; i < numTasks; i = next++)
+	{
+		(*task)(i);
+		count++;
+	}
+	return count;
+}
+
+void ThreadPool::run(int count, const function<void(int)>& fn)
+{
+	if (count <= 0)
+		return;
+	if (workers.empty() || count == 1)
+	{
+		for (int i = 0; i < count; i++)
+			fn(i);
+		return;
+	}
+
+	{
+		lock_guard<mutex> lock(poolMutex);
+		task = &fn;
+		numTasks = count;
+		finished = 0;
+		next = 0;
+		generation++;
+	}
+	wake.notify_all();
+
+	// caller helps out
+	int ran = work();
+
+	// wait until all tasks ran and no worker is still inside this generation
+	unique_lock<mutex> lock(poolMutex);
+	finished += ran;
+	allDone.wait(lock, [&] { return finished == numTasks && active == 0; });
+	task = nullptr;
+	numTasks = 0;
+}
+
+void ThreadPool::parallelFor(int n, const function<void(int, int)>& fn, int minChunk)
+{
+	int chunks = min(size() * 4, (n + minChunk - 1) / minChunk);
+	if (chunks <= 1)
+	{
+		if (n > 0)
+			fn(0, n);
+		return;
+	}
+	run(chunks, [&](int c) {
+		fn((int)((long long)n * c / chunks), (int)((long long)n * (c + 1) / chunks));
+	});
+}
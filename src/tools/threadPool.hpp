@@ -0,0 +1,44 @@
+// Fixed-size thread pool for data parallel loops
+
+#ifndef TOOLS_THREADPOOL_HPP
+#define TOOLS_THREADPOOL_HPP
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+class ThreadPool
+{
+public:
+	ThreadPool(int threads = 0); // 0: one per hardware thread
+	~ThreadPool();
+
+	// number of threads including the caller
+	int size() const { return (int)workers.size() + 1; }
+
+	// run fn(i) for i in [0, count), blocks until all are done
+	void run(int count, const std::function<void(int)>& fn);
+
+	// run fn(begin, end) on chunks of [0, n), blocks until all are done
+	void parallelFor(int n, const std::function<void(int, int)>& fn, int minChunk = 1024);
+
+protected:
+	void worker();
+	int work();
+
+	std::vector<std::thread> workers;
+	std::mutex poolMutex;
+	std::condition_variable wake, allDone;
+	const std::function<void(int)>* task = nullptr;
+	int numTasks = 0;
+	std::atomic<int> next { 0 };
+	int finished = 0;
+	int active = 0; // workers inside the current generation
+	unsigned generation = 0;
+	bool quit = false;
+};
+
+#endif